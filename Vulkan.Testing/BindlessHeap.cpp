@@ -0,0 +1,198 @@
+#include "BindlessHeap.h"
+#include "VkUtils.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+BindlessHeap::BindlessHeap()
+{
+}
+
+BindlessHeap::~BindlessHeap()
+{
+}
+
+void BindlessHeap::Create(VkPhysicalDevice physicalDevice, VkDevice device, DeletionQueue* deletionQueue)
+{
+	m_VkDevice = device;
+	m_DeletionQueue = deletionQueue;
+
+	// Update after bind descriptors have their own, usually much higher, limits
+	VkPhysicalDeviceDescriptorIndexingProperties indexing{};
+	indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+
+	VkPhysicalDeviceProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &indexing;
+	vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+	m_Buffers.Capacity = std::min({ MAX_BUFFERS, indexing.maxDescriptorSetUpdateAfterBindStorageBuffers, indexing.maxPerStageDescriptorUpdateAfterBindStorageBuffers });
+	m_Textures.Capacity = std::min({ MAX_TEXTURES, indexing.maxDescriptorSetUpdateAfterBindSampledImages, indexing.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		indexing.maxDescriptorSetUpdateAfterBindSamplers, indexing.maxPerStageDescriptorUpdateAfterBindSamplers });
+
+	// Both arrays are visible to every stage, so together they also have to fit the per stage resource limit
+	auto perStage = indexing.maxPerStageUpdateAfterBindResources;
+	auto budget = perStage > RESERVED_RESOURCES ? perStage - RESERVED_RESOURCES : 0;
+	if (m_Buffers.Capacity + m_Textures.Capacity > budget)
+	{
+		auto buffers = (uint32_t)((uint64_t)m_Buffers.Capacity * budget / (m_Buffers.Capacity + m_Textures.Capacity));
+		m_Textures.Capacity = budget - buffers;
+		m_Buffers.Capacity = buffers;
+	}
+
+	VkDescriptorSetLayoutBinding bindings[2]{};
+	bindings[0].binding = BUFFER_BINDING;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[0].descriptorCount = m_Buffers.Capacity;
+	bindings[0].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT;
+
+	bindings[1].binding = TEXTURE_BINDING;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[1].descriptorCount = m_Textures.Capacity;
+	bindings[1].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT;
+
+	// Slots nothing reads may stay empty, and may change while submitted frames read other slots
+	VkDescriptorBindingFlags flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+		VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+	VkDescriptorBindingFlags bindingFlags[2] = { flags, flags };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+	flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	flagsInfo.bindingCount = 2;
+	flagsInfo.pBindingFlags = bindingFlags;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext = &flagsInfo;
+	layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+
+	Vk::Check(vkCreateDescriptorSetLayout(m_VkDevice, &layoutInfo, nullptr, &m_Layout));
+
+	VkDescriptorPoolSize poolSizes[2] = {
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, m_Buffers.Capacity },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, m_Textures.Capacity },
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+
+	Vk::Check(vkCreateDescriptorPool(m_VkDevice, &poolInfo, nullptr, &m_Pool));
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_Pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_Layout;
+
+	Vk::Check(vkAllocateDescriptorSets(m_VkDevice, &allocInfo, &m_Set));
+
+	std::cout << "Bindless heap: " << m_Buffers.Capacity << " buffers, " << m_Textures.Capacity << " textures\n";
+}
+
+void BindlessHeap::Destroy()
+{
+	vkDestroyDescriptorPool(m_VkDevice, m_Pool, nullptr);
+	vkDestroyDescriptorSetLayout(m_VkDevice, m_Layout, nullptr);
+	m_Pool = VK_NULL_HANDLE;
+	m_Layout = VK_NULL_HANDLE;
+	m_Set = VK_NULL_HANDLE;
+}
+
+uint32_t BindlessHeap::AddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto index = Acquire(m_Buffers, "buffer");
+	WriteBuffer(index, buffer, offset, range);
+	return index;
+}
+
+uint32_t BindlessHeap::AddTexture(VkImageView view, VkSampler sampler)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto index = Acquire(m_Textures, "texture");
+	WriteTexture(index, view, sampler);
+	return index;
+}
+
+void BindlessHeap::UpdateTexture(uint32_t index, VkImageView view, VkSampler sampler)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	WriteTexture(index, view, sampler);
+}
+
+void BindlessHeap::RemoveBuffer(uint32_t index)
+{
+	m_DeletionQueue->Retire([this, index]() { Release(m_Buffers, index); });
+}
+
+void BindlessHeap::RemoveTexture(uint32_t index)
+{
+	m_DeletionQueue->Retire([this, index]() { Release(m_Textures, index); });
+}
+
+uint32_t BindlessHeap::Acquire(Slots& slots, const char* kind)
+{
+	if (!slots.Free.empty())
+	{
+		auto index = slots.Free.back();
+		slots.Free.pop_back();
+		return index;
+	}
+
+	if (slots.Next == slots.Capacity)
+	{
+		throw std::runtime_error(std::string("bindless heap is out of ") + kind + " slots!");
+	}
+
+	return slots.Next++;
+}
+
+void BindlessHeap::Release(Slots& slots, uint32_t index)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	slots.Free.push_back(index);
+}
+
+void BindlessHeap::WriteBuffer(uint32_t index, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range)
+{
+	VkDescriptorBufferInfo bufferInfo{};
+	bufferInfo.buffer = buffer;
+	bufferInfo.offset = offset;
+	bufferInfo.range = range;
+
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = m_Set;
+	write.dstBinding = BUFFER_BINDING;
+	write.dstArrayElement = index;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	write.descriptorCount = 1;
+	write.pBufferInfo = &bufferInfo;
+
+	vkUpdateDescriptorSets(m_VkDevice, 1, &write, 0, nullptr);
+}
+
+void BindlessHeap::WriteTexture(uint32_t index, VkImageView view, VkSampler sampler)
+{
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.sampler = sampler;
+	imageInfo.imageView = view;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = m_Set;
+	write.dstBinding = TEXTURE_BINDING;
+	write.dstArrayElement = index;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	write.descriptorCount = 1;
+	write.pImageInfo = &imageInfo;
+
+	vkUpdateDescriptorSets(m_VkDevice, 1, &write, 0, nullptr);
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "DeletionQueue.h"
+
+// One global descriptor set with every buffer and texture the shaders can reach, bound once per command
+// buffer and indexed through push constants. Written with update after bind and partially bound, so slots
+// can be filled while frames that use other slots are in flight.
+class BindlessHeap
+{
+public:
+	static const uint32_t BUFFER_BINDING = 0;
+	static const uint32_t TEXTURE_BINDING = 1;
+	static const uint32_t MAX_BUFFERS = 4096;
+	static const uint32_t MAX_TEXTURES = 16384;
+
+	// Left of the per stage limit for the other sets of a pipeline layout and the color attachments
+	static const uint32_t RESERVED_RESOURCES = 32;
+
+	BindlessHeap();
+	virtual ~BindlessHeap();
+
+	// Needs the descriptor indexing features enabled on the device
+	void Create(VkPhysicalDevice physicalDevice, VkDevice device, DeletionQueue* deletionQueue);
+	void Destroy();
+
+	// Storage buffers and combined image samplers, the returned index is what shaders use
+	uint32_t AddBuffer(VkBuffer buffer, VkDeviceSize offset = 0, VkDeviceSize range = VK_WHOLE_SIZE);
+	uint32_t AddTexture(VkImageView view, VkSampler sampler);
+	void UpdateTexture(uint32_t index, VkImageView view, VkSampler sampler);
+
+	// The index is handed out again once the frames that could still read it finished
+	void RemoveBuffer(uint32_t index);
+	void RemoveTexture(uint32_t index);
+
+	constexpr VkDescriptorSetLayout Layout() const { return m_Layout; }
+	constexpr VkDescriptorSet Set() const { return m_Set; }
+
+private:
+	struct Slots
+	{
+		uint32_t Capacity = 0;
+		uint32_t Next = 0;
+		std::vector<uint32_t> Free;
+	};
+
+	uint32_t Acquire(Slots& slots, const char* kind);
+	void Release(Slots& slots, uint32_t index);
+	void WriteBuffer(uint32_t index, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+	void WriteTexture(uint32_t index, VkImageView view, VkSampler sampler);
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	DeletionQueue* m_DeletionQueue = nullptr;
+
+	VkDescriptorSetLayout m_Layout = VK_NULL_HANDLE;
+	VkDescriptorPool m_Pool = VK_NULL_HANDLE;
+	VkDescriptorSet m_Set = VK_NULL_HANDLE;
+
+	// Streaming threads add textures while the main thread records
+	std::mutex m_Mutex;
+	Slots m_Buffers;
+	Slots m_Textures;
+};
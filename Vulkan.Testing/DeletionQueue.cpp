@@ -0,0 +1,134 @@
+#include "DeletionQueue.h"
+#include <iterator>
+
+DeletionQueue::DeletionQueue()
+{
+}
+
+DeletionQueue::~DeletionQueue()
+{
+}
+
+void DeletionQueue::Create(VkDevice device, GpuAllocator* allocator, GpuTimeline* timeline)
+{
+	m_VkDevice = device;
+	m_Allocator = allocator;
+	m_Timeline = timeline;
+}
+
+void DeletionQueue::Retire(uint64_t lastUse, std::function<void()> destroy)
+{
+	// Keep the queue sorted so Collect can stop at the first entry still in use
+	auto position = m_Entries.end();
+	while (position != m_Entries.begin() && std::prev(position)->LastUse > lastUse)
+	{
+		--position;
+	}
+
+	m_Entries.insert(position, { lastUse, std::move(destroy) });
+}
+
+void DeletionQueue::Retire(std::function<void()> destroy)
+{
+	Retire(m_Timeline->Submitted(), std::move(destroy));
+}
+
+void DeletionQueue::Retire(VkBuffer buffer, const GpuAllocation& allocation)
+{
+	Retire(m_Timeline->Submitted(), [=]() { auto copy = allocation; m_Allocator->DestroyBuffer(buffer, copy); });
+}
+
+void DeletionQueue::Retire(VkImage image, const GpuAllocation& allocation)
+{
+	Retire(m_Timeline->Submitted(), [=]() { auto copy = allocation; m_Allocator->DestroyImage(image, copy); });
+}
+
+void DeletionQueue::Retire(const GpuAllocation& allocation)
+{
+	Retire(m_Timeline->Submitted(), [=]() { auto copy = allocation; m_Allocator->Free(copy); });
+}
+
+void DeletionQueue::Retire(VkImageView imageView)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroyImageView(m_VkDevice, imageView, nullptr); });
+}
+
+void DeletionQueue::Retire(VkSampler sampler)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroySampler(m_VkDevice, sampler, nullptr); });
+}
+
+void DeletionQueue::Retire(VkFramebuffer framebuffer)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroyFramebuffer(m_VkDevice, framebuffer, nullptr); });
+}
+
+void DeletionQueue::Retire(VkRenderPass renderPass)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroyRenderPass(m_VkDevice, renderPass, nullptr); });
+}
+
+void DeletionQueue::Retire(VkShaderModule shaderModule)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroyShaderModule(m_VkDevice, shaderModule, nullptr); });
+}
+
+void DeletionQueue::Retire(VkPipeline pipeline)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroyPipeline(m_VkDevice, pipeline, nullptr); });
+}
+
+void DeletionQueue::Retire(VkPipelineLayout pipelineLayout)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroyPipelineLayout(m_VkDevice, pipelineLayout, nullptr); });
+}
+
+void DeletionQueue::Retire(VkDescriptorPool descriptorPool)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroyDescriptorPool(m_VkDevice, descriptorPool, nullptr); });
+}
+
+void DeletionQueue::Retire(VkDescriptorPool descriptorPool, VkDescriptorSet descriptorSet)
+{
+	// The pool has to be created with VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT
+	Retire(m_Timeline->Submitted(), [=]() { vkFreeDescriptorSets(m_VkDevice, descriptorPool, 1, &descriptorSet); });
+}
+
+void DeletionQueue::Retire(VkCommandPool commandPool, std::vector<VkCommandBuffer> commandBuffers)
+{
+	if (commandBuffers.empty())
+	{
+		return;
+	}
+
+	Retire(m_Timeline->Submitted(), [=]()
+	{
+		vkFreeCommandBuffers(m_VkDevice, commandPool, (uint32_t)commandBuffers.size(), commandBuffers.data());
+	});
+}
+
+void DeletionQueue::Retire(VkSwapchainKHR swapchain)
+{
+	Retire(m_Timeline->Submitted(), [=]() { vkDestroySwapchainKHR(m_VkDevice, swapchain, nullptr); });
+}
+
+void DeletionQueue::Collect()
+{
+	while (!m_Entries.empty() && m_Timeline->IsComplete(m_Entries.front().LastUse))
+	{
+		// Popped first so a destroy callback may retire more objects
+		auto destroy = std::move(m_Entries.front().Destroy);
+		m_Entries.pop_front();
+		destroy();
+	}
+}
+
+void DeletionQueue::Flush()
+{
+	while (!m_Entries.empty())
+	{
+		auto destroy = std::move(m_Entries.front().Destroy);
+		m_Entries.pop_front();
+		destroy();
+	}
+}
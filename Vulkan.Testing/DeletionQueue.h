@@ -0,0 +1,62 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "GpuAllocator.h"
+#include "GpuTimeline.h"
+
+// Objects released mid-run wait here until the GPU timeline passed the last submission that used them.
+// The typed overloads tag objects with the last submitted value, so they must not be referenced by
+// work that is recorded but not yet submitted, use the explicit value overload for that.
+class DeletionQueue
+{
+public:
+	DeletionQueue();
+	virtual ~DeletionQueue();
+
+	void Create(VkDevice device, GpuAllocator* allocator, GpuTimeline* timeline);
+
+	void Retire(uint64_t lastUse, std::function<void()> destroy);
+
+	// Tagged with the last submitted value like the typed overloads
+	void Retire(std::function<void()> destroy);
+
+	void Retire(VkBuffer buffer, const GpuAllocation& allocation);
+	void Retire(VkImage image, const GpuAllocation& allocation);
+	void Retire(const GpuAllocation& allocation);
+	void Retire(VkImageView imageView);
+	void Retire(VkSampler sampler);
+	void Retire(VkFramebuffer framebuffer);
+	void Retire(VkRenderPass renderPass);
+	void Retire(VkShaderModule shaderModule);
+	void Retire(VkPipeline pipeline);
+	void Retire(VkPipelineLayout pipelineLayout);
+	void Retire(VkDescriptorPool descriptorPool);
+	void Retire(VkDescriptorPool descriptorPool, VkDescriptorSet descriptorSet);
+	void Retire(VkCommandPool commandPool, std::vector<VkCommandBuffer> commandBuffers);
+	void Retire(VkSwapchainKHR swapchain);
+
+	// Destroys whatever the GPU is done with, never waits
+	void Collect();
+
+	// Destroys everything, the device has to be idle
+	void Flush();
+
+	constexpr size_t Size() const { return m_Entries.size(); }
+
+private:
+	struct Entry
+	{
+		uint64_t LastUse;
+		std::function<void()> Destroy;
+	};
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	GpuAllocator* m_Allocator = nullptr;
+	GpuTimeline* m_Timeline = nullptr;
+
+	// Ordered by value as long as retiring only ever uses the latest submitted value
+	std::deque<Entry> m_Entries;
+};
@@ -0,0 +1,146 @@
+#include "DescriptorArena.h"
+#include "VkUtils.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace
+{
+	// Descriptors per set of each type, sized for the sets the renderer allocates per frame
+	const VkDescriptorPoolSize POOL_RATIOS[] =
+	{
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1 },
+		{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1 },
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2 },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1 },
+	};
+}
+
+DescriptorArena::DescriptorArena()
+{
+}
+
+DescriptorArena::~DescriptorArena()
+{
+}
+
+void DescriptorArena::Create(VkDevice device, DeletionQueue* deletionQueue, uint32_t slotCount)
+{
+	m_VkDevice = device;
+	m_DeletionQueue = deletionQueue;
+	m_SlotPools.resize(slotCount);
+}
+
+void DescriptorArena::Destroy()
+{
+	// The deletion queue was flushed before, every retired pool is back on the free list
+	for (auto& pools : m_SlotPools)
+	{
+		m_FreePools.insert(m_FreePools.end(), pools.begin(), pools.end());
+	}
+
+	for (auto pool : m_FreePools)
+	{
+		vkDestroyDescriptorPool(m_VkDevice, pool, nullptr);
+	}
+
+	m_SlotPools.clear();
+	m_FreePools.clear();
+	m_Current = VK_NULL_HANDLE;
+}
+
+void DescriptorArena::Resize(uint32_t slotCount)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_SlotPools.resize(std::max<size_t>(m_SlotPools.size(), slotCount));
+}
+
+void DescriptorArena::BeginFrame(uint32_t slot)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (slot >= m_SlotPools.size())
+	{
+		throw std::runtime_error("descriptor arena slot is out of range!");
+	}
+
+	m_Slot = slot;
+	m_Current = VK_NULL_HANDLE;
+	if (m_SlotPools[slot].empty())
+	{
+		return;
+	}
+
+	// One reset per pool instead of one free per set, once nothing submitted so far can read them
+	auto pools = std::move(m_SlotPools[slot]);
+	m_SlotPools[slot].clear();
+	m_DeletionQueue->Retire([this, pools]()
+	{
+		for (auto pool : pools)
+		{
+			Vk::Check(vkResetDescriptorPool(m_VkDevice, pool, 0));
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_FreePools.insert(m_FreePools.end(), pools.begin(), pools.end());
+	});
+}
+
+VkDescriptorSet DescriptorArena::Allocate(VkDescriptorSetLayout layout)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	if (m_Current == VK_NULL_HANDLE)
+	{
+		m_Current = NextPool();
+	}
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_Current;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &layout;
+
+	VkDescriptorSet set;
+	auto result = vkAllocateDescriptorSets(m_VkDevice, &allocInfo, &set);
+
+	// Full, retry once with a fresh pool
+	if (result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL)
+	{
+		m_Current = NextPool();
+		allocInfo.descriptorPool = m_Current;
+		result = vkAllocateDescriptorSets(m_VkDevice, &allocInfo, &set);
+	}
+
+	Vk::Check(result);
+	return set;
+}
+
+VkDescriptorPool DescriptorArena::NextPool()
+{
+	VkDescriptorPool pool;
+	if (!m_FreePools.empty())
+	{
+		pool = m_FreePools.back();
+		m_FreePools.pop_back();
+	}
+	else
+	{
+		std::vector<VkDescriptorPoolSize> poolSizes;
+		for (auto ratio : POOL_RATIOS)
+		{
+			poolSizes.push_back({ ratio.type, ratio.descriptorCount * SETS_PER_POOL });
+		}
+
+		// No FREE_DESCRIPTOR_SET_BIT, the pool only ever allocates linearly
+		VkDescriptorPoolCreateInfo poolInfo{};
+		poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+		poolInfo.maxSets = SETS_PER_POOL;
+		poolInfo.poolSizeCount = (uint32_t)poolSizes.size();
+		poolInfo.pPoolSizes = poolSizes.data();
+
+		Vk::Check(vkCreateDescriptorPool(m_VkDevice, &poolInfo, nullptr, &pool));
+	}
+
+	m_SlotPools[m_Slot].push_back(pool);
+	return pool;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "DeletionQueue.h"
+
+// Descriptor sets that live for a single recording of a command buffer. They are allocated linearly from pools
+// owned by the frame slot being recorded, and the pools go back through the deletion queue as a whole once the
+// slot is recorded again, sets are never freed one by one. A full pool just moves on to the next one, pools are
+// recycled between frames.
+class DescriptorArena
+{
+public:
+	static const uint32_t SETS_PER_POOL = 256;
+
+	DescriptorArena();
+	virtual ~DescriptorArena();
+
+	// One slot per recorded command buffer, like the uniform ring
+	void Create(VkDevice device, DeletionQueue* deletionQueue, uint32_t slotCount);
+	void Destroy();
+
+	// Only grows, the existing slots keep their pools
+	void Resize(uint32_t slotCount);
+
+	// Allocations go to the slot from now on. Its previous pools are reset once the submissions that may still
+	// use them finished, so this never waits and also works for static command buffers that are re-recorded
+	void BeginFrame(uint32_t slot);
+
+	// Valid until the slot is recorded again. Safe to call from recording workers
+	VkDescriptorSet Allocate(VkDescriptorSetLayout layout);
+
+private:
+	VkDescriptorPool NextPool();
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	DeletionQueue* m_DeletionQueue = nullptr;
+	uint32_t m_Slot = 0;
+	VkDescriptorPool m_Current = VK_NULL_HANDLE;
+
+	// Per frame slot, the pools handed out since it was last recorded
+	std::vector<std::vector<VkDescriptorPool>> m_SlotPools;
+	std::vector<VkDescriptorPool> m_FreePools;
+	std::mutex m_Mutex;
+};
@@ -0,0 +1,52 @@
+#include <SDL_timer.h>
+#include "FrameLimiter.h"
+
+namespace
+{
+	// SDL_Delay can oversleep by about a scheduler tick, leave that much to the spin
+	const double SPIN_TIME = 0.002;
+}
+
+FrameLimiter::FrameLimiter(double targetFps)
+{
+	if (targetFps > 0.0)
+	{
+		m_FrameTime = 1.0 / targetFps;
+	}
+
+	m_Timer.Start();
+}
+
+FrameLimiter::~FrameLimiter()
+{
+}
+
+void FrameLimiter::Wait()
+{
+	if (!IsActive())
+	{
+		return;
+	}
+
+	m_Timer.Tick();
+	auto now = m_Timer.TotalTime();
+
+	// Deadlines advance by whole frames so short frames don't drift the pacing, a long hitch restarts it
+	m_Deadline += m_FrameTime;
+	if (m_Deadline < now - m_FrameTime)
+	{
+		m_Deadline = now;
+	}
+
+	while (now < m_Deadline)
+	{
+		auto remaining = m_Deadline - now;
+		if (remaining > SPIN_TIME)
+		{
+			SDL_Delay((Uint32)((remaining - SPIN_TIME) * 1000.0));
+		}
+
+		m_Timer.Tick();
+		now = m_Timer.TotalTime();
+	}
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Timer.h"
+
+class FrameLimiter
+{
+public:
+	// A target of zero frames per second disables the limiter
+	FrameLimiter(double targetFps);
+	virtual ~FrameLimiter();
+
+	// Blocks until the next frame is due, sleeping for most of the wait and spinning for the last bit
+	void Wait();
+
+	constexpr bool IsActive() const { return m_FrameTime > 0.0; }
+
+private:
+	Timer m_Timer;
+	double m_FrameTime = 0.0;
+	double m_Deadline = 0.0;
+};
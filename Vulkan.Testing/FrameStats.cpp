@@ -0,0 +1,189 @@
+#include "FrameStats.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+FrameStats::FrameStats()
+{
+	for (auto& sample : m_Samples)
+	{
+		sample.store(0.0f, std::memory_order_relaxed);
+	}
+}
+
+FrameStats::~FrameStats()
+{
+}
+
+void FrameStats::Push(double deltaTime)
+{
+	auto head = m_Head.load(std::memory_order_relaxed);
+	m_Samples[head % CAPACITY].store((float)(deltaTime * 1000.0), std::memory_order_relaxed);
+	m_Head.store(head + 1, std::memory_order_release);
+}
+
+bool FrameStats::Summarise(FrameSummary& summary)
+{
+	auto head = m_Head.load(std::memory_order_acquire);
+	if (head == m_Tail)
+	{
+		return false;
+	}
+
+	// If the writer lapped us only the newest CAPACITY frames are still there
+	if (head - m_Tail > CAPACITY)
+	{
+		m_Tail = head - CAPACITY;
+	}
+
+	uint32_t count = (uint32_t)(head - m_Tail);
+	double total = 0.0;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		m_Scratch[i] = m_Samples[(m_Tail + i) % CAPACITY].load(std::memory_order_relaxed);
+		total += m_Scratch[i];
+	}
+
+	m_Tail = head;
+
+	// Nearest rank percentiles
+	std::sort(m_Scratch.begin(), m_Scratch.begin() + count);
+	auto percentile = [&](double p)
+	{
+		auto rank = (uint32_t)(p * (count - 1) + 0.5);
+		return (double)m_Scratch[rank];
+	};
+
+	summary.Sequence = ++m_Sequence;
+	summary.FrameCount = count;
+	summary.Average = total / count;
+	summary.P50 = percentile(0.50);
+	summary.P95 = percentile(0.95);
+	summary.P99 = percentile(0.99);
+	summary.Max = m_Scratch[count - 1];
+
+	// Samples are sorted so the hitches are the tail above the threshold
+	auto threshold = (float)(summary.P50 * HITCH_FACTOR);
+	auto firstHitch = std::upper_bound(m_Scratch.begin(), m_Scratch.begin() + count, threshold);
+	summary.Hitches = (uint32_t)(m_Scratch.begin() + count - firstHitch);
+
+	return true;
+}
+
+FrameStatsExporter::FrameStatsExporter(FrameStats& stats, const std::string& path, double interval) :
+	m_Stats(stats), m_Path(path), m_Interval(interval)
+{
+	auto extension = path.size() >= 5 ? path.substr(path.size() - 5) : "";
+	m_Json = extension == ".json";
+}
+
+FrameStatsExporter::~FrameStatsExporter()
+{
+	Stop();
+}
+
+void FrameStatsExporter::Start()
+{
+	if (!m_Path.empty())
+	{
+		m_File.open(m_Path, std::ios::trunc);
+		if (!m_File.is_open())
+		{
+			std::cout << "Could not open frame stats file " << m_Path << '\n';
+		}
+		else if (!m_Json)
+		{
+			m_File << "time,frames,avg_ms,p50_ms,p95_ms,p99_ms,max_ms,hitches\n";
+		}
+	}
+
+	m_Running = true;
+	m_Thread = std::thread(&FrameStatsExporter::Run, this);
+}
+
+void FrameStatsExporter::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (!m_Running)
+		{
+			return;
+		}
+
+		m_Running = false;
+	}
+
+	m_Wake.notify_all();
+	m_Thread.join();
+	m_File.close();
+}
+
+bool FrameStatsExporter::Latest(FrameSummary& summary)
+{
+	if (m_Shared.load(std::memory_order_relaxed) & FRESH)
+	{
+		m_Front = m_Shared.exchange(m_Front, std::memory_order_acq_rel) & ~FRESH;
+	}
+
+	summary = m_Summaries[m_Front];
+	return summary.Sequence != 0;
+}
+
+void FrameStatsExporter::Run()
+{
+	auto start = std::chrono::steady_clock::now();
+	auto interval = std::chrono::duration<double>(m_Interval);
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (true)
+	{
+		bool stopping = m_Wake.wait_for(lock, interval, [this] { return !m_Running; });
+
+		// Summarise and write outside the lock so Stop() never waits on file I/O
+		lock.unlock();
+
+		auto& summary = m_Summaries[m_Back];
+		if (m_Stats.Summarise(summary))
+		{
+			summary.Time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			Write(summary);
+
+			// Publish, the slot the reader last left becomes the next back slot
+			m_Back = m_Shared.exchange(m_Back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+		}
+
+		lock.lock();
+
+		if (stopping)
+		{
+			break;
+		}
+	}
+}
+
+void FrameStatsExporter::Write(const FrameSummary& summary)
+{
+	if (!m_File.is_open())
+	{
+		return;
+	}
+
+	if (m_Json)
+	{
+		m_File << "{\"time\":" << summary.Time
+			<< ",\"frames\":" << summary.FrameCount
+			<< ",\"avg_ms\":" << summary.Average
+			<< ",\"p50_ms\":" << summary.P50
+			<< ",\"p95_ms\":" << summary.P95
+			<< ",\"p99_ms\":" << summary.P99
+			<< ",\"max_ms\":" << summary.Max
+			<< ",\"hitches\":" << summary.Hitches << "}\n";
+	}
+	else
+	{
+		m_File << summary.Time << ',' << summary.FrameCount << ',' << summary.Average << ',' << summary.P50 << ','
+			<< summary.P95 << ',' << summary.P99 << ',' << summary.Max << ',' << summary.Hitches << '\n';
+	}
+
+	m_File.flush();
+}
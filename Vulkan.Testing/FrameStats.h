@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct FrameSummary
+{
+	uint64_t Sequence = 0;
+	double Time = 0.0;
+
+	// Frame times in milliseconds over one reporting window
+	uint32_t FrameCount = 0;
+	double Average = 0.0;
+	double P50 = 0.0;
+	double P95 = 0.0;
+	double P99 = 0.0;
+	double Max = 0.0;
+
+	// Frames that took more than HITCH_FACTOR times the median
+	uint32_t Hitches = 0;
+};
+
+class FrameStats
+{
+public:
+	static const uint32_t CAPACITY = 8192;
+	static constexpr double HITCH_FACTOR = 2.0;
+
+	FrameStats();
+	virtual ~FrameStats();
+
+	// Render thread only, never blocks or allocates
+	void Push(double deltaTime);
+
+	// Single reader, summarises every frame pushed since the previous call
+	bool Summarise(FrameSummary& summary);
+
+private:
+	std::array<std::atomic<float>, CAPACITY> m_Samples;
+	std::atomic<uint64_t> m_Head = 0;
+
+	// Reader state
+	uint64_t m_Tail = 0;
+	uint64_t m_Sequence = 0;
+	std::array<float, CAPACITY> m_Scratch;
+};
+
+class FrameStatsExporter
+{
+public:
+	// Writes CSV, or JSON lines when the path ends in .json. An empty path only keeps the latest summary.
+	FrameStatsExporter(FrameStats& stats, const std::string& path, double interval);
+	virtual ~FrameStatsExporter();
+
+	void Start();
+	void Stop();
+
+	// Latest published summary, never blocks. Single reader, meant for the render thread
+	bool Latest(FrameSummary& summary);
+
+private:
+	void Run();
+	void Write(const FrameSummary& summary);
+
+	FrameStats& m_Stats;
+	std::string m_Path;
+	double m_Interval;
+	bool m_Json = false;
+	std::ofstream m_File;
+
+	std::thread m_Thread;
+	std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	bool m_Running = false;
+
+	// Triple buffer, the exporter fills the back slot and swaps it with the shared one, the reader swaps the
+	// shared slot with its front slot whenever it is marked fresh. Neither side ever waits on the other
+	static const uint32_t FRESH = 4;
+	std::array<FrameSummary, 3> m_Summaries;
+	std::atomic<uint32_t> m_Shared{ 1 };
+	uint32_t m_Back = 0;
+	uint32_t m_Front = 2;
+};
@@ -0,0 +1,406 @@
+#include "GpuAllocator.h"
+#include "VkUtils.h"
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+}
+
+GpuAllocator::GpuAllocator()
+{
+}
+
+GpuAllocator::~GpuAllocator()
+{
+}
+
+void GpuAllocator::Create(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize)
+{
+	m_VkDevice = device;
+	m_BlockSize = blockSize;
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_MemoryProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	m_MaxAllocationCount = properties.limits.maxMemoryAllocationCount;
+	m_NonCoherentAtomSize = std::max<VkDeviceSize>(1, properties.limits.nonCoherentAtomSize);
+}
+
+void GpuAllocator::Destroy()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (uint32_t i = 0; i < m_Blocks.size(); i++)
+	{
+		if (m_Blocks[i].AllocationCount > 0)
+		{
+			std::cout << "GPU allocator block " << i << " destroyed with " << m_Blocks[i].AllocationCount << " live allocations\n";
+		}
+
+		DestroyBlock(i);
+	}
+
+	m_Blocks.clear();
+	m_UnusedBlocks.clear();
+}
+
+GpuAllocation GpuAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, GpuResourceKind kind)
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	auto size = requirements.size;
+	auto alignment = std::max<VkDeviceSize>(1, requirements.alignment);
+	auto dedicated = size > m_BlockSize / 2;
+
+	// Try every memory type that fits, a full heap moves on to the next one
+	for (uint32_t type = 0; type < m_MemoryProperties.memoryTypeCount; type++)
+	{
+		auto flags = m_MemoryProperties.memoryTypes[type].propertyFlags;
+		if (!(requirements.memoryTypeBits & (1u << type)) || (flags & properties) != properties)
+		{
+			continue;
+		}
+
+		// Mapped ranges are flushed in whole atoms, keep neighbours from sharing one
+		auto typeAlignment = alignment;
+		if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		{
+			typeAlignment = std::max(alignment, m_NonCoherentAtomSize);
+		}
+
+		GpuAllocation allocation;
+		VkDeviceSize offset = 0;
+
+		if (!dedicated)
+		{
+			for (uint32_t i = 0; i < m_Blocks.size(); i++)
+			{
+				auto& block = m_Blocks[i];
+				if (block.Memory == VK_NULL_HANDLE || block.Dedicated || block.MemoryType != type || block.Kind != kind)
+				{
+					continue;
+				}
+
+				if (AllocateFromBlock(block, size, typeAlignment, offset))
+				{
+					allocation.Block = i;
+					break;
+				}
+			}
+		}
+
+		if (allocation.Block == UINT32_MAX)
+		{
+			// Small heaps (e.g. a BAR window) get smaller blocks so one block can't exhaust them
+			auto heapSize = m_MemoryProperties.memoryHeaps[m_MemoryProperties.memoryTypes[type].heapIndex].size;
+			auto blockSize = dedicated ? size : std::max(size, std::min(m_BlockSize, heapSize / 8));
+
+			auto index = CreateBlock(type, blockSize, kind, dedicated);
+			if (index == UINT32_MAX)
+			{
+				continue;
+			}
+
+			AllocateFromBlock(m_Blocks[index], size, typeAlignment, offset);
+			allocation.Block = index;
+		}
+
+		auto& block = m_Blocks[allocation.Block];
+		allocation.Memory = block.Memory;
+		allocation.Offset = offset;
+		allocation.Size = size;
+		allocation.Mapped = block.Mapped ? static_cast<char*>(block.Mapped) + offset : nullptr;
+		return allocation;
+	}
+
+	throw std::runtime_error("failed to allocate GPU memory!");
+}
+
+void GpuAllocator::Free(GpuAllocation& allocation)
+{
+	if (allocation.Block == UINT32_MAX)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	auto& block = m_Blocks[allocation.Block];
+	if (block.Dedicated)
+	{
+		DestroyBlock(allocation.Block);
+	}
+	else
+	{
+		FreeToBlock(block, allocation.Offset, allocation.Size);
+	}
+
+	allocation = GpuAllocation();
+}
+
+VkBuffer GpuAllocator::CreateBuffer(const VkBufferCreateInfo& createInfo, VkMemoryPropertyFlags properties, GpuAllocation& allocation)
+{
+	VkBuffer buffer;
+	Vk::Check(vkCreateBuffer(m_VkDevice, &createInfo, nullptr, &buffer));
+
+	VkMemoryRequirements requirements;
+	vkGetBufferMemoryRequirements(m_VkDevice, buffer, &requirements);
+
+	allocation = Allocate(requirements, properties, GpuResourceKind::Linear);
+	Vk::Check(vkBindBufferMemory(m_VkDevice, buffer, allocation.Memory, allocation.Offset));
+	return buffer;
+}
+
+VkImage GpuAllocator::CreateImage(const VkImageCreateInfo& createInfo, VkMemoryPropertyFlags properties, GpuAllocation& allocation)
+{
+	VkImage image;
+	Vk::Check(vkCreateImage(m_VkDevice, &createInfo, nullptr, &image));
+
+	VkMemoryRequirements requirements;
+	vkGetImageMemoryRequirements(m_VkDevice, image, &requirements);
+
+	auto kind = createInfo.tiling == VK_IMAGE_TILING_OPTIMAL ? GpuResourceKind::Optimal : GpuResourceKind::Linear;
+	allocation = Allocate(requirements, properties, kind);
+	Vk::Check(vkBindImageMemory(m_VkDevice, image, allocation.Memory, allocation.Offset));
+	return image;
+}
+
+void GpuAllocator::DestroyBuffer(VkBuffer buffer, GpuAllocation& allocation)
+{
+	vkDestroyBuffer(m_VkDevice, buffer, nullptr);
+	Free(allocation);
+}
+
+void GpuAllocator::DestroyImage(VkImage image, GpuAllocation& allocation)
+{
+	vkDestroyImage(m_VkDevice, image, nullptr);
+	Free(allocation);
+}
+
+uint32_t GpuAllocator::FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < m_MemoryProperties.memoryTypeCount; i++)
+	{
+		if ((typeFilter & (1 << i)) && (m_MemoryProperties.memoryTypes[i].propertyFlags & properties) == properties)
+		{
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+bool GpuAllocator::AllocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	// Best fit, the range that leaves the least behind
+	size_t best = SIZE_MAX;
+	VkDeviceSize bestLeftover = 0;
+	for (size_t i = 0; i < block.FreeRanges.size(); i++)
+	{
+		const auto& range = block.FreeRanges[i];
+		auto aligned = AlignUp(range.Offset, alignment);
+		auto padding = aligned - range.Offset;
+		if (padding + size > range.Size)
+		{
+			continue;
+		}
+
+		auto leftover = range.Size - padding - size;
+		if (best == SIZE_MAX || leftover < bestLeftover)
+		{
+			best = i;
+			bestLeftover = leftover;
+		}
+	}
+
+	if (best == SIZE_MAX)
+	{
+		return false;
+	}
+
+	// Split the range into the alignment padding in front and whatever is left behind
+	auto range = block.FreeRanges[best];
+	offset = AlignUp(range.Offset, alignment);
+	block.FreeRanges.erase(block.FreeRanges.begin() + best);
+
+	auto end = offset + size;
+	auto rangeEnd = range.Offset + range.Size;
+	if (rangeEnd > end)
+	{
+		block.FreeRanges.insert(block.FreeRanges.begin() + best, { end, rangeEnd - end });
+	}
+
+	if (offset > range.Offset)
+	{
+		block.FreeRanges.insert(block.FreeRanges.begin() + best, { range.Offset, offset - range.Offset });
+	}
+
+	block.AllocationCount++;
+	return true;
+}
+
+void GpuAllocator::FreeToBlock(Block& block, VkDeviceSize offset, VkDeviceSize size)
+{
+	auto next = std::lower_bound(block.FreeRanges.begin(), block.FreeRanges.end(), offset, [](const Range& range, VkDeviceSize value)
+	{
+		return range.Offset < value;
+	});
+
+	auto index = next - block.FreeRanges.begin();
+	block.FreeRanges.insert(next, { offset, size });
+
+	// Merge with the following range, then with the previous one
+	if (index + 1 < (ptrdiff_t)block.FreeRanges.size())
+	{
+		auto& current = block.FreeRanges[index];
+		const auto& following = block.FreeRanges[index + 1];
+		if (current.Offset + current.Size == following.Offset)
+		{
+			current.Size += following.Size;
+			block.FreeRanges.erase(block.FreeRanges.begin() + index + 1);
+		}
+	}
+
+	if (index > 0)
+	{
+		auto& previous = block.FreeRanges[index - 1];
+		const auto& current = block.FreeRanges[index];
+		if (previous.Offset + previous.Size == current.Offset)
+		{
+			previous.Size += current.Size;
+			block.FreeRanges.erase(block.FreeRanges.begin() + index);
+		}
+	}
+
+	block.AllocationCount--;
+}
+
+uint32_t GpuAllocator::CreateBlock(uint32_t memoryType, VkDeviceSize size, GpuResourceKind kind, bool dedicated)
+{
+	if (m_DeviceAllocationCount >= m_MaxAllocationCount)
+	{
+		std::cout << "GPU allocator hit maxMemoryAllocationCount (" << m_MaxAllocationCount << ")\n";
+		return UINT32_MAX;
+	}
+
+	Block block;
+	block.Size = size;
+	block.MemoryType = memoryType;
+	block.Kind = kind;
+	block.Dedicated = dedicated;
+	block.FreeRanges.push_back({ 0, size });
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryType;
+
+	// Running out of one heap is not fatal, the caller tries the next memory type
+	auto result = vkAllocateMemory(m_VkDevice, &allocInfo, nullptr, &block.Memory);
+	if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY)
+	{
+		return UINT32_MAX;
+	}
+
+	Vk::Check(result);
+	m_DeviceAllocationCount++;
+
+	if (m_MemoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+	{
+		Vk::Check(vkMapMemory(m_VkDevice, block.Memory, 0, VK_WHOLE_SIZE, 0, &block.Mapped));
+	}
+
+	// Reuse the slot of a released dedicated block so allocation indices stay small
+	if (!m_UnusedBlocks.empty())
+	{
+		auto index = m_UnusedBlocks.back();
+		m_UnusedBlocks.pop_back();
+		m_Blocks[index] = std::move(block);
+		return index;
+	}
+
+	m_Blocks.push_back(std::move(block));
+	return (uint32_t)m_Blocks.size() - 1;
+}
+
+void GpuAllocator::DestroyBlock(uint32_t index)
+{
+	auto& block = m_Blocks[index];
+	if (block.Memory == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	if (block.Mapped)
+	{
+		vkUnmapMemory(m_VkDevice, block.Memory);
+	}
+
+	vkFreeMemory(m_VkDevice, block.Memory, nullptr);
+	m_DeviceAllocationCount--;
+
+	block = Block();
+	m_UnusedBlocks.push_back(index);
+}
+
+GpuAllocatorStats GpuAllocator::Stats() const
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+
+	GpuAllocatorStats stats;
+	VkDeviceSize totalFree = 0;
+	VkDeviceSize unusableFree = 0;
+	for (const auto& block : m_Blocks)
+	{
+		if (block.Memory == VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
+		stats.BlockCount++;
+		stats.Reserved += block.Size;
+
+		if (block.Dedicated)
+		{
+			stats.AllocationCount++;
+			stats.Used += block.Size;
+			continue;
+		}
+
+		stats.AllocationCount += block.AllocationCount;
+		stats.FreeRangeCount += (uint32_t)block.FreeRanges.size();
+
+		VkDeviceSize blockFree = 0;
+		VkDeviceSize blockLargest = 0;
+		for (const auto& range : block.FreeRanges)
+		{
+			blockFree += range.Size;
+			blockLargest = std::max(blockLargest, range.Size);
+		}
+
+		// Free memory outside the largest hole of its block can only serve smaller requests
+		totalFree += blockFree;
+		unusableFree += blockFree - blockLargest;
+		stats.LargestFreeRange = std::max(stats.LargestFreeRange, blockLargest);
+		stats.Used += block.Size - blockFree;
+	}
+
+	if (totalFree > 0)
+	{
+		stats.Fragmentation = (double)unusableFree / (double)totalFree;
+	}
+
+	return stats;
+}
+
+void GpuAllocator::Report() const
+{
+	auto stats = Stats();
+	std::cout << "GPU memory: " << stats.BlockCount << " blocks, " << stats.AllocationCount << " allocations, "
+		<< stats.Used / 1024 << " / " << stats.Reserved / 1024 << " KiB used, "
+		<< stats.FreeRangeCount << " free ranges, fragmentation " << stats.Fragmentation * 100.0 << "%\n";
+}
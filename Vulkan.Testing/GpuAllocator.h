@@ -0,0 +1,103 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+enum class GpuResourceKind
+{
+	// Buffers and linear images
+	Linear,
+
+	// Optimal tiling images, kept in separate blocks so bufferImageGranularity never applies
+	Optimal,
+};
+
+struct GpuAllocation
+{
+	VkDeviceMemory Memory = VK_NULL_HANDLE;
+	VkDeviceSize Offset = 0;
+	VkDeviceSize Size = 0;
+
+	// Host visible blocks stay mapped for their whole lifetime
+	void* Mapped = nullptr;
+	uint32_t Block = UINT32_MAX;
+};
+
+struct GpuAllocatorStats
+{
+	uint32_t BlockCount = 0;
+	uint32_t AllocationCount = 0;
+	uint32_t FreeRangeCount = 0;
+	VkDeviceSize Reserved = 0;
+	VkDeviceSize Used = 0;
+	VkDeviceSize LargestFreeRange = 0;
+
+	// 0 when every block's free memory is one range, approaching 1 as it splits into small holes
+	double Fragmentation = 0.0;
+};
+
+class GpuAllocator
+{
+public:
+	static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull * 1024 * 1024;
+
+	GpuAllocator();
+	virtual ~GpuAllocator();
+
+	void Create(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize blockSize = DEFAULT_BLOCK_SIZE);
+	void Destroy();
+
+	// Sub-allocates from a block of a matching memory type, resources bigger than half a block get their own
+	GpuAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, GpuResourceKind kind);
+	void Free(GpuAllocation& allocation);
+
+	// Create the resource and bind it to a new allocation
+	VkBuffer CreateBuffer(const VkBufferCreateInfo& createInfo, VkMemoryPropertyFlags properties, GpuAllocation& allocation);
+	VkImage CreateImage(const VkImageCreateInfo& createInfo, VkMemoryPropertyFlags properties, GpuAllocation& allocation);
+	void DestroyBuffer(VkBuffer buffer, GpuAllocation& allocation);
+	void DestroyImage(VkImage image, GpuAllocation& allocation);
+
+	uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+	constexpr const VkPhysicalDeviceMemoryProperties& MemoryProperties() const { return m_MemoryProperties; }
+
+	GpuAllocatorStats Stats() const;
+	void Report() const;
+
+private:
+	struct Range
+	{
+		VkDeviceSize Offset;
+		VkDeviceSize Size;
+	};
+
+	struct Block
+	{
+		VkDeviceMemory Memory = VK_NULL_HANDLE;
+		VkDeviceSize Size = 0;
+		uint32_t MemoryType = 0;
+		GpuResourceKind Kind = GpuResourceKind::Linear;
+		bool Dedicated = false;
+		void* Mapped = nullptr;
+		uint32_t AllocationCount = 0;
+
+		// Sorted by offset, neighbours are always coalesced
+		std::vector<Range> FreeRanges;
+	};
+
+	bool AllocateFromBlock(Block& block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	void FreeToBlock(Block& block, VkDeviceSize offset, VkDeviceSize size);
+	uint32_t CreateBlock(uint32_t memoryType, VkDeviceSize size, GpuResourceKind kind, bool dedicated);
+	void DestroyBlock(uint32_t index);
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties m_MemoryProperties{};
+	VkDeviceSize m_BlockSize = DEFAULT_BLOCK_SIZE;
+	VkDeviceSize m_NonCoherentAtomSize = 1;
+	uint32_t m_MaxAllocationCount = 0;
+	uint32_t m_DeviceAllocationCount = 0;
+
+	std::vector<Block> m_Blocks;
+	std::vector<uint32_t> m_UnusedBlocks;
+	mutable std::mutex m_Mutex;
+};
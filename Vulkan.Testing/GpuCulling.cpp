@@ -0,0 +1,529 @@
+#include "GpuCulling.h"
+#include "VkUtils.h"
+#include "Mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+namespace
+{
+	// Matches the push constant block of Culling.comp
+	struct CullConstants
+	{
+		float Planes[6][4];
+		uint32_t ObjectCount;
+		uint32_t Occlusion;
+		float PyramidSize[2];
+	};
+}
+
+Frustum Frustum::FromViewProjection(const float matrix[16])
+{
+	// Row i of the matrix
+	auto row = [&](int i, int column) { return matrix[column * 4 + i]; };
+
+	Frustum frustum;
+	for (int column = 0; column < 4; column++)
+	{
+		frustum.Planes[0][column] = row(3, column) + row(0, column); // Left
+		frustum.Planes[1][column] = row(3, column) - row(0, column); // Right
+		frustum.Planes[2][column] = row(3, column) + row(1, column); // Bottom
+		frustum.Planes[3][column] = row(3, column) - row(1, column); // Top
+		frustum.Planes[4][column] = row(2, column);                  // Near
+		frustum.Planes[5][column] = row(3, column) - row(2, column); // Far
+	}
+
+	// Normalised so the plane distance can be compared against a radius
+	for (auto& plane : frustum.Planes)
+	{
+		auto length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+		for (auto& value : plane)
+		{
+			value /= length;
+		}
+	}
+
+	return frustum;
+}
+
+GpuCulling::GpuCulling()
+{
+}
+
+GpuCulling::~GpuCulling()
+{
+}
+
+void GpuCulling::Create(VkDevice device, GpuAllocator* allocator, StagingRing* staging, DescriptorArena* descriptors, VkPipelineCache pipelineCache,
+	const ShaderArchive* shaders, VkBuffer instances, VkBuffer indirect, const std::vector<BoundingSphere>& bounds, VkExtent2D extent,
+	bool occlusion, VkSampleCountFlagBits depthSamples)
+{
+	m_VkDevice = device;
+	m_Allocator = allocator;
+	m_Staging = staging;
+	m_Descriptors = descriptors;
+	m_DepthSamples = depthSamples;
+	m_IndirectBuffer = indirect;
+	m_ObjectCount = (uint32_t)bounds.size();
+
+	// Bounds, read only
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = sizeof(BoundingSphere) * bounds.size();
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	m_BoundsBuffer = m_Allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_BoundsAllocation);
+	m_Staging->Upload(m_BoundsBuffer, 0, bounds.data(), bufferInfo.size);
+
+	// Compacted instances, sized for the case where nothing is culled
+	bufferInfo.size = sizeof(InstanceData) * bounds.size();
+	bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	m_OutputBuffer = m_Allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_OutputAllocation);
+
+	CreatePyramid(extent);
+	CreateDescriptors(instances, indirect);
+	CreatePipeline(pipelineCache, shaders);
+
+	if (occlusion)
+	{
+		// Multisampled depth is read with texelFetch per sample, every later level is a plain reduction
+		CreatePyramidDescriptors();
+		m_DepthPipeline = CreateComputePipeline(pipelineCache, shaders, depthSamples != VK_SAMPLE_COUNT_1_BIT ? "shaders/pyramid_ms.spv" : "shaders/pyramid.spv", m_PyramidLayout);
+		m_ReducePipeline = CreateComputePipeline(pipelineCache, shaders, "shaders/pyramid.spv", m_PyramidLayout);
+	}
+}
+
+void GpuCulling::Destroy()
+{
+	if (m_VkDevice == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	vkDestroyPipeline(m_VkDevice, m_ReducePipeline, nullptr);
+	vkDestroyPipeline(m_VkDevice, m_DepthPipeline, nullptr);
+	vkDestroyPipelineLayout(m_VkDevice, m_PyramidLayout, nullptr);
+	vkDestroyDescriptorPool(m_VkDevice, m_PyramidPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_VkDevice, m_PyramidSetLayout, nullptr);
+	m_ReducePipeline = VK_NULL_HANDLE;
+	m_DepthPipeline = VK_NULL_HANDLE;
+	m_PyramidLayout = VK_NULL_HANDLE;
+	m_DepthView = VK_NULL_HANDLE;
+	m_PyramidPool = VK_NULL_HANDLE;
+	m_PyramidSetLayout = VK_NULL_HANDLE;
+	m_PyramidSets.clear();
+	m_Occlusion = false;
+
+	vkDestroyPipeline(m_VkDevice, m_Pipeline, nullptr);
+	vkDestroyPipelineLayout(m_VkDevice, m_PipelineLayout, nullptr);
+	vkDestroyDescriptorPool(m_VkDevice, m_DescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(m_VkDevice, m_SetLayout, nullptr);
+
+	vkDestroySampler(m_VkDevice, m_PyramidSampler, nullptr);
+	for (auto view : m_MipViews)
+	{
+		vkDestroyImageView(m_VkDevice, view, nullptr);
+	}
+	m_MipViews.clear();
+	vkDestroyImageView(m_VkDevice, m_PyramidView, nullptr);
+	m_Allocator->DestroyImage(m_PyramidImage, m_PyramidAllocation);
+
+	m_Allocator->DestroyBuffer(m_OutputBuffer, m_OutputAllocation);
+	m_Allocator->DestroyBuffer(m_BoundsBuffer, m_BoundsAllocation);
+	m_VkDevice = VK_NULL_HANDLE;
+}
+
+void GpuCulling::CreatePyramid(VkExtent2D extent)
+{
+	// Rounded down, the first level of the build covers the depth texels of a whole pyramid texel however they line up
+	auto floorPowerOfTwo = [](uint32_t value)
+	{
+		uint32_t result = 1;
+		while (result * 2 <= value)
+		{
+			result *= 2;
+		}
+		return result;
+	};
+
+	m_PyramidExtent = { floorPowerOfTwo(extent.width), floorPowerOfTwo(extent.height) };
+	m_PyramidMips = (uint32_t)std::log2((double)std::max(m_PyramidExtent.width, m_PyramidExtent.height)) + 1;
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = VK_FORMAT_R32_SFLOAT;
+	imageInfo.extent = { m_PyramidExtent.width, m_PyramidExtent.height, 1 };
+	imageInfo.mipLevels = m_PyramidMips;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	m_PyramidImage = m_Allocator->CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_PyramidAllocation);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = m_PyramidImage;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = VK_FORMAT_R32_SFLOAT;
+	viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel = 0;
+	viewInfo.subresourceRange.levelCount = m_PyramidMips;
+	viewInfo.subresourceRange.baseArrayLayer = 0;
+	viewInfo.subresourceRange.layerCount = 1;
+
+	Vk::Check(vkCreateImageView(m_VkDevice, &viewInfo, nullptr, &m_PyramidView));
+
+	// One view per level, the build writes one level at a time while reading the one above
+	m_MipViews.resize(m_PyramidMips);
+	for (uint32_t level = 0; level < m_PyramidMips; level++)
+	{
+		auto mipInfo = viewInfo;
+		mipInfo.subresourceRange.baseMipLevel = level;
+		mipInfo.subresourceRange.levelCount = 1;
+		Vk::Check(vkCreateImageView(m_VkDevice, &mipInfo, nullptr, &m_MipViews[level]));
+	}
+
+	// Exact texel fetches, the shader picks the mip itself
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_NEAREST;
+	samplerInfo.minFilter = VK_FILTER_NEAREST;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+	samplerInfo.minLod = 0.0f;
+	samplerInfo.maxLod = (float)m_PyramidMips;
+
+	Vk::Check(vkCreateSampler(m_VkDevice, &samplerInfo, nullptr, &m_PyramidSampler));
+
+	// Starts out as the far plane everywhere so nothing reads as occluded, it stays in the general layout for storage writes
+	auto commandBuffer = m_Staging->CommandBuffer();
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask = 0;
+	barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = m_PyramidImage;
+	barrier.subresourceRange = viewInfo.subresourceRange;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkClearColorValue farDepth = { { 1.0f, 1.0f, 1.0f, 1.0f } };
+	vkCmdClearColorImage(commandBuffer, m_PyramidImage, VK_IMAGE_LAYOUT_GENERAL, &farDepth, 1, &viewInfo.subresourceRange);
+}
+
+void GpuCulling::CreateDescriptors(VkBuffer instances, VkBuffer indirect)
+{
+	// Source instances, bounds, compacted instances, indirect commands and the pyramid
+	VkDescriptorSetLayoutBinding bindings[5]{};
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	bindings[4].binding = 4;
+	bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[4].descriptorCount = 1;
+	bindings[4].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 5;
+	layoutInfo.pBindings = bindings;
+
+	Vk::Check(vkCreateDescriptorSetLayout(m_VkDevice, &layoutInfo, nullptr, &m_SetLayout));
+
+	VkDescriptorPoolSize poolSizes[2]{};
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[0].descriptorCount = 4;
+	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[1].descriptorCount = 1;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+
+	Vk::Check(vkCreateDescriptorPool(m_VkDevice, &poolInfo, nullptr, &m_DescriptorPool));
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_DescriptorPool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_SetLayout;
+
+	Vk::Check(vkAllocateDescriptorSets(m_VkDevice, &allocInfo, &m_DescriptorSet));
+
+	VkBuffer buffers[4] = { instances, m_BoundsBuffer, m_OutputBuffer, indirect };
+	VkDescriptorBufferInfo bufferInfos[4]{};
+	VkWriteDescriptorSet writes[5]{};
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		bufferInfos[i].buffer = buffers[i];
+		bufferInfos[i].offset = 0;
+		bufferInfos[i].range = VK_WHOLE_SIZE;
+
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = m_DescriptorSet;
+		writes[i].dstBinding = i;
+		writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		writes[i].descriptorCount = 1;
+		writes[i].pBufferInfo = &bufferInfos[i];
+	}
+
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.sampler = m_PyramidSampler;
+	imageInfo.imageView = m_PyramidView;
+	imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	writes[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	writes[4].dstSet = m_DescriptorSet;
+	writes[4].dstBinding = 4;
+	writes[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	writes[4].descriptorCount = 1;
+	writes[4].pImageInfo = &imageInfo;
+
+	vkUpdateDescriptorSets(m_VkDevice, 5, writes, 0, nullptr);
+}
+
+void GpuCulling::CreatePipeline(VkPipelineCache pipelineCache, const ShaderArchive* shaders)
+{
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullConstants);
+
+	VkPipelineLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutInfo.setLayoutCount = 1;
+	layoutInfo.pSetLayouts = &m_SetLayout;
+	layoutInfo.pushConstantRangeCount = 1;
+	layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	Vk::Check(vkCreatePipelineLayout(m_VkDevice, &layoutInfo, nullptr, &m_PipelineLayout));
+
+	m_Pipeline = CreateComputePipeline(pipelineCache, shaders, "shaders/cull.spv", m_PipelineLayout);
+}
+
+VkPipeline GpuCulling::CreateComputePipeline(VkPipelineCache pipelineCache, const ShaderArchive* shaders, const char* path, VkPipelineLayout layout)
+{
+	std::vector<uint32_t> storage;
+	auto code = shaders->Load(path, storage);
+
+	VkShaderModuleCreateInfo moduleInfo{};
+	moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	moduleInfo.codeSize = code.Size;
+	moduleInfo.pCode = code.Code;
+
+	VkShaderModule shaderModule;
+	Vk::Check(vkCreateShaderModule(m_VkDevice, &moduleInfo, nullptr, &shaderModule));
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = shaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.layout = layout;
+
+	VkPipeline pipeline;
+	Vk::Check(vkCreateComputePipelines(m_VkDevice, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline));
+
+	vkDestroyShaderModule(m_VkDevice, shaderModule, nullptr);
+	return pipeline;
+}
+
+void GpuCulling::CreatePyramidDescriptors()
+{
+	// The level above, or the depth buffer, and the level being written
+	VkDescriptorSetLayoutBinding bindings[2]{};
+	bindings[0].binding = 0;
+	bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount = 1;
+	bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	bindings[1].binding = 1;
+	bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+	bindings[1].descriptorCount = 1;
+	bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 2;
+	layoutInfo.pBindings = bindings;
+
+	Vk::Check(vkCreateDescriptorSetLayout(m_VkDevice, &layoutInfo, nullptr, &m_PyramidSetLayout));
+
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(PyramidConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &m_PyramidSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	Vk::Check(vkCreatePipelineLayout(m_VkDevice, &pipelineLayoutInfo, nullptr, &m_PyramidLayout));
+
+	// Every level but the first only ever reads the pyramid itself, so their sets never change
+	m_PyramidSets.assign(m_PyramidMips, VK_NULL_HANDLE);
+	if (m_PyramidMips == 1)
+	{
+		return;
+	}
+
+	auto setCount = m_PyramidMips - 1;
+	VkDescriptorPoolSize poolSizes[2] = {
+		{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, setCount },
+		{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, setCount },
+	};
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = setCount;
+	poolInfo.poolSizeCount = 2;
+	poolInfo.pPoolSizes = poolSizes;
+
+	Vk::Check(vkCreateDescriptorPool(m_VkDevice, &poolInfo, nullptr, &m_PyramidPool));
+
+	std::vector<VkDescriptorSetLayout> layouts(setCount, m_PyramidSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_PyramidPool;
+	allocInfo.descriptorSetCount = setCount;
+	allocInfo.pSetLayouts = layouts.data();
+
+	Vk::Check(vkAllocateDescriptorSets(m_VkDevice, &allocInfo, &m_PyramidSets[1]));
+
+	for (uint32_t level = 1; level < m_PyramidMips; level++)
+	{
+		WritePyramidSet(m_PyramidSets[level], m_MipViews[level - 1], VK_IMAGE_LAYOUT_GENERAL, level);
+	}
+}
+
+void GpuCulling::WritePyramidSet(VkDescriptorSet set, VkImageView source, VkImageLayout sourceLayout, uint32_t level)
+{
+	VkDescriptorImageInfo imageInfos[2]{};
+	imageInfos[0].sampler = m_PyramidSampler;
+	imageInfos[0].imageView = source;
+	imageInfos[0].imageLayout = sourceLayout;
+	imageInfos[1].imageView = m_MipViews[level];
+	imageInfos[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+	VkWriteDescriptorSet writes[2]{};
+	for (uint32_t i = 0; i < 2; i++)
+	{
+		writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		writes[i].dstSet = set;
+		writes[i].dstBinding = i;
+		writes[i].descriptorType = i == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+		writes[i].descriptorCount = 1;
+		writes[i].pImageInfo = &imageInfos[i];
+	}
+
+	vkUpdateDescriptorSets(m_VkDevice, 2, writes, 0, nullptr);
+}
+
+void GpuCulling::SetDepth(VkImageView depth, VkExtent2D extent)
+{
+	if (m_PyramidLayout == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	// Submitted frames keep the sets they were recorded with, only later recordings see the new buffer
+	m_DepthView = depth;
+	m_DepthExtent = extent;
+	m_Occlusion = true;
+}
+
+VkExtent2D GpuCulling::MipExtent(uint32_t level) const
+{
+	return { std::max(1u, m_PyramidExtent.width >> level), std::max(1u, m_PyramidExtent.height >> level) };
+}
+
+void GpuCulling::Record(VkCommandBuffer commandBuffer, const Frustum& frustum)
+{
+	// Survivors are counted up from zero
+	vkCmdFillBuffer(commandBuffer, m_IndirectBuffer, offsetof(VkDrawIndexedIndirectCommand, instanceCount), sizeof(uint32_t), 0);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	CullConstants constants;
+	std::copy(&frustum.Planes[0][0], &frustum.Planes[0][0] + 24, &constants.Planes[0][0]);
+	constants.ObjectCount = m_ObjectCount;
+	constants.Occlusion = m_Occlusion ? 1 : 0;
+	constants.PyramidSize[0] = (float)m_PyramidExtent.width;
+	constants.PyramidSize[1] = (float)m_PyramidExtent.height;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_Pipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_PipelineLayout, 0, 1, &m_DescriptorSet, 0, nullptr);
+	vkCmdPushConstants(commandBuffer, m_PipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+	vkCmdDispatch(commandBuffer, (m_ObjectCount + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+}
+
+void GpuCulling::RecordPyramid(VkCommandBuffer commandBuffer)
+{
+	if (!m_Occlusion)
+	{
+		return;
+	}
+
+	// Written fresh every recording, the previous set of this slot may still be read by an older submission
+	m_PyramidSets[0] = m_Descriptors->Allocate(m_PyramidSetLayout);
+	WritePyramidSet(m_PyramidSets[0], m_DepthView, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, 0);
+
+	// The cull pass of this frame has to be done reading the pyramid before it is overwritten
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+	for (uint32_t level = 0; level < m_PyramidMips; level++)
+	{
+		auto source = level == 0 ? m_DepthExtent : MipExtent(level - 1);
+		auto destination = MipExtent(level);
+
+		PyramidConstants constants;
+		constants.SourceSize[0] = source.width;
+		constants.SourceSize[1] = source.height;
+		constants.DestinationSize[0] = destination.width;
+		constants.DestinationSize[1] = destination.height;
+		constants.Samples = level == 0 ? (uint32_t)m_DepthSamples : 1;
+
+		if (level <= 1)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, level == 0 ? m_DepthPipeline : m_ReducePipeline);
+		}
+
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_PyramidLayout, 0, 1, &m_PyramidSets[level], 0, nullptr);
+		vkCmdPushConstants(commandBuffer, m_PyramidLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+		vkCmdDispatch(commandBuffer, (destination.width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, (destination.height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE, 1);
+
+		// Each level reads the one before it, the last barrier makes the whole pyramid visible to the next frame's cull pass
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+	}
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "GpuAllocator.h"
+#include "StagingRing.h"
+#include "ShaderArchive.h"
+#include "DescriptorArena.h"
+
+struct BoundingSphere
+{
+	float Center[3];
+	float Radius;
+};
+
+// Six planes facing inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+struct Frustum
+{
+	float Planes[6][4];
+
+	// Gribb-Hartmann extraction from a column major view projection matrix with 0..1 depth
+	static Frustum FromViewProjection(const float matrix[16]);
+};
+
+// Compute pass that culls objects against the frustum and a Hi-Z depth pyramid, then compacts the
+// survivors into an instance buffer and writes their count into the indirect draw the graphics pass consumes
+class GpuCulling
+{
+public:
+	static const uint32_t GROUP_SIZE = 64;
+	static const uint32_t PYRAMID_GROUP_SIZE = 8;
+
+	GpuCulling();
+	virtual ~GpuCulling();
+
+	// Instances and indirect are read and written by the pass, the bounds are uploaded through the staging ring.
+	// Without occlusion the pyramid is never built and only the frustum test runs
+	void Create(VkDevice device, GpuAllocator* allocator, StagingRing* staging, DescriptorArena* descriptors, VkPipelineCache pipelineCache,
+		const ShaderArchive* shaders, VkBuffer instances, VkBuffer indirect, const std::vector<BoundingSphere>& bounds, VkExtent2D extent,
+		bool occlusion, VkSampleCountFlagBits depthSamples);
+	void Destroy();
+
+	// Depth buffer the pyramid is built from, in the depth stencil read only layout. Called again whenever it is
+	// recreated, recordings from then on read the new one. Occlusion testing starts with the first call
+	void SetDepth(VkImageView depth, VkExtent2D extent);
+
+	// Recording, must be called outside of a render pass. Ordering against the draws on either side is left
+	// to the render graph, which sees the indirect and output buffers as written by this pass
+	void Record(VkCommandBuffer commandBuffer, const Frustum& frustum);
+
+	// Reduces this frame's depth into the pyramid the next frame culls against, must be called outside of a render pass.
+	// The set reading the depth buffer comes from the arena slot being recorded
+	void RecordPyramid(VkCommandBuffer commandBuffer);
+
+	// Compacted instance data, bind this instead of the source instances when drawing
+	constexpr VkBuffer Output() const { return m_OutputBuffer; }
+
+private:
+	struct PyramidConstants
+	{
+		uint32_t SourceSize[2];
+		uint32_t DestinationSize[2];
+		uint32_t Samples;
+	};
+
+	void CreatePyramid(VkExtent2D extent);
+	void CreateDescriptors(VkBuffer instances, VkBuffer indirect);
+	void CreatePyramidDescriptors();
+	void CreatePipeline(VkPipelineCache pipelineCache, const ShaderArchive* shaders);
+	VkPipeline CreateComputePipeline(VkPipelineCache pipelineCache, const ShaderArchive* shaders, const char* path, VkPipelineLayout layout);
+	void WritePyramidSet(VkDescriptorSet set, VkImageView source, VkImageLayout sourceLayout, uint32_t level);
+	VkExtent2D MipExtent(uint32_t level) const;
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	GpuAllocator* m_Allocator = nullptr;
+	StagingRing* m_Staging = nullptr;
+	DescriptorArena* m_Descriptors = nullptr;
+	uint32_t m_ObjectCount = 0;
+	bool m_Occlusion = false;
+
+	VkBuffer m_IndirectBuffer = VK_NULL_HANDLE;
+	VkBuffer m_BoundsBuffer = VK_NULL_HANDLE;
+	GpuAllocation m_BoundsAllocation;
+	VkBuffer m_OutputBuffer = VK_NULL_HANDLE;
+	GpuAllocation m_OutputAllocation;
+
+	// Hi-Z, a power of two in both dimensions so every texel covers exactly two by two texels of the level above it.
+	// Every mip holds the farthest depth of the texels below it
+	VkExtent2D m_PyramidExtent{};
+	uint32_t m_PyramidMips = 0;
+	VkImage m_PyramidImage = VK_NULL_HANDLE;
+	GpuAllocation m_PyramidAllocation;
+	VkImageView m_PyramidView = VK_NULL_HANDLE;
+	std::vector<VkImageView> m_MipViews;
+	VkSampler m_PyramidSampler = VK_NULL_HANDLE;
+
+	// Pyramid build, one set per level. The first level reads the depth buffer, its set is allocated per recording
+	VkImageView m_DepthView = VK_NULL_HANDLE;
+	VkExtent2D m_DepthExtent{};
+	VkSampleCountFlagBits m_DepthSamples = VK_SAMPLE_COUNT_1_BIT;
+	VkDescriptorSetLayout m_PyramidSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool m_PyramidPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> m_PyramidSets;
+	VkPipelineLayout m_PyramidLayout = VK_NULL_HANDLE;
+	VkPipeline m_DepthPipeline = VK_NULL_HANDLE;
+	VkPipeline m_ReducePipeline = VK_NULL_HANDLE;
+
+	// Pipeline
+	VkDescriptorSetLayout m_SetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool m_DescriptorPool = VK_NULL_HANDLE;
+	VkDescriptorSet m_DescriptorSet = VK_NULL_HANDLE;
+	VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_Pipeline = VK_NULL_HANDLE;
+};
@@ -0,0 +1,176 @@
+#include "GpuProfiler.h"
+#include "VkUtils.h"
+#include <cstring>
+#include <iostream>
+
+namespace
+{
+	const uint32_t QUERIES_PER_SLOT = GpuProfiler::MAX_SCOPES * 2;
+}
+
+GpuProfiler::GpuProfiler()
+{
+}
+
+GpuProfiler::~GpuProfiler()
+{
+}
+
+void GpuProfiler::Create(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t slotCount)
+{
+	m_VkDevice = device;
+
+	// Timestamps have to be supported on the queue we submit to
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+
+	uint32_t validBits = queueFamilies[queueFamily].timestampValidBits;
+	if (validBits == 0)
+	{
+		std::cout << "GPU timestamps not supported, profiling disabled\n";
+		return;
+	}
+
+	m_TimestampMask = validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	m_TimestampPeriod = properties.limits.timestampPeriod;
+
+	// Query pool
+	VkQueryPoolCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	createInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+	createInfo.queryCount = QUERIES_PER_SLOT * slotCount;
+
+	Vk::Check(vkCreateQueryPool(m_VkDevice, &createInfo, nullptr, &m_QueryPool));
+
+	m_Scopes.resize(slotCount);
+	for (auto& scopes : m_Scopes)
+	{
+		scopes.reserve(MAX_SCOPES);
+	}
+
+	// Value and availability per query
+	m_QueryData.resize(QUERIES_PER_SLOT * 2);
+	m_Results.reserve(MAX_SCOPES);
+}
+
+void GpuProfiler::Destroy()
+{
+	if (m_QueryPool != VK_NULL_HANDLE)
+	{
+		vkDestroyQueryPool(m_VkDevice, m_QueryPool, nullptr);
+		m_QueryPool = VK_NULL_HANDLE;
+	}
+}
+
+void GpuProfiler::BeginFrame(VkCommandBuffer commandBuffer, uint32_t slot)
+{
+	if (!IsSupported() || slot >= m_Scopes.size())
+	{
+		return;
+	}
+
+	m_Scopes[slot].clear();
+	vkCmdResetQueryPool(commandBuffer, m_QueryPool, slot * QUERIES_PER_SLOT, QUERIES_PER_SLOT);
+}
+
+uint32_t GpuProfiler::BeginScope(VkCommandBuffer commandBuffer, uint32_t slot, const char* name)
+{
+	if (!IsSupported() || slot >= m_Scopes.size() || m_Scopes[slot].size() == MAX_SCOPES)
+	{
+		return UINT32_MAX;
+	}
+
+	auto& scopes = m_Scopes[slot];
+
+	Scope scope;
+	scope.Name = name;
+	scope.Query = slot * QUERIES_PER_SLOT + (uint32_t)scopes.size() * 2;
+	scopes.push_back(scope);
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_QueryPool, scope.Query);
+	return (uint32_t)scopes.size() - 1;
+}
+
+void GpuProfiler::EndScope(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t scope)
+{
+	if (scope == UINT32_MAX)
+	{
+		return;
+	}
+
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_QueryPool, m_Scopes[slot][scope].Query + 1);
+}
+
+void GpuProfiler::Collect(uint32_t slot)
+{
+	if (!IsSupported() || slot >= m_Scopes.size() || m_Scopes[slot].empty())
+	{
+		return;
+	}
+
+	// Without the wait bit this returns VK_NOT_READY instead of blocking, availability is checked per query
+	auto& scopes = m_Scopes[slot];
+	uint32_t queryCount = (uint32_t)scopes.size() * 2;
+	auto result = vkGetQueryPoolResults(m_VkDevice, m_QueryPool, slot * QUERIES_PER_SLOT, queryCount,
+		queryCount * 2 * sizeof(uint64_t), m_QueryData.data(), 2 * sizeof(uint64_t),
+		VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+
+	if (result != VK_SUCCESS && result != VK_NOT_READY)
+	{
+		Vk::Check(result);
+	}
+
+	for (size_t i = 0; i < scopes.size(); i++)
+	{
+		const uint64_t* begin = &m_QueryData[i * 4];
+		const uint64_t* end = &m_QueryData[i * 4 + 2];
+		if (begin[1] == 0 || end[1] == 0)
+		{
+			continue;
+		}
+
+		auto ticks = ((end[0] & m_TimestampMask) - (begin[0] & m_TimestampMask)) & m_TimestampMask;
+		auto time = ticks * m_TimestampPeriod * 1e-9;
+
+		// Scope lists are tiny, a linear search keeps this allocation free
+		GpuScopeResult* found = nullptr;
+		for (auto& scopeResult : m_Results)
+		{
+			if (std::strcmp(scopeResult.Name, scopes[i].Name) == 0)
+			{
+				found = &scopeResult;
+				break;
+			}
+		}
+
+		if (found == nullptr && m_Results.size() < MAX_SCOPES)
+		{
+			m_Results.push_back({ scopes[i].Name, 0.0 });
+			found = &m_Results.back();
+		}
+
+		if (found != nullptr)
+		{
+			found->Time = time;
+		}
+	}
+}
+
+double GpuProfiler::ScopeTime(const char* name) const
+{
+	for (const auto& scopeResult : m_Results)
+	{
+		if (std::strcmp(scopeResult.Name, name) == 0)
+		{
+			return scopeResult.Time;
+		}
+	}
+
+	return 0.0;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+struct GpuScopeResult
+{
+	const char* Name = nullptr;
+	double Time = 0.0;
+};
+
+class GpuProfiler
+{
+public:
+	static const uint32_t MAX_SCOPES = 16;
+
+	GpuProfiler();
+	virtual ~GpuProfiler();
+
+	// One slot per command buffer that records scopes
+	void Create(VkPhysicalDevice physicalDevice, VkDevice device, uint32_t queueFamily, uint32_t slotCount);
+	void Destroy();
+
+	// Recording, must be called outside of a render pass
+	void BeginFrame(VkCommandBuffer commandBuffer, uint32_t slot);
+
+	// Names must outlive the profiler, string literals are expected
+	uint32_t BeginScope(VkCommandBuffer commandBuffer, uint32_t slot, const char* name);
+	void EndScope(VkCommandBuffer commandBuffer, uint32_t slot, uint32_t scope);
+
+	// Reads back a slot once the fence of its submission has signalled, never waits on the GPU
+	void Collect(uint32_t slot);
+
+	// Last resolved GPU time of a scope in seconds, the same unit as Timer
+	double ScopeTime(const char* name) const;
+	const std::vector<GpuScopeResult>& Results() const { return m_Results; }
+
+	constexpr bool IsSupported() const { return m_QueryPool != VK_NULL_HANDLE; }
+
+private:
+	struct Scope
+	{
+		const char* Name;
+		uint32_t Query;
+	};
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	VkQueryPool m_QueryPool = VK_NULL_HANDLE;
+	double m_TimestampPeriod = 0.0;
+	uint64_t m_TimestampMask = 0;
+
+	// Recorded scopes per slot, two queries each
+	std::vector<std::vector<Scope>> m_Scopes;
+	std::vector<uint64_t> m_QueryData;
+	std::vector<GpuScopeResult> m_Results;
+};
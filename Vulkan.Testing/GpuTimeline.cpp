@@ -0,0 +1,62 @@
+#include "GpuTimeline.h"
+#include "VkUtils.h"
+
+GpuTimeline::GpuTimeline()
+{
+}
+
+GpuTimeline::~GpuTimeline()
+{
+}
+
+void GpuTimeline::Create(VkDevice device)
+{
+	m_VkDevice = device;
+
+	VkSemaphoreTypeCreateInfo typeInfo{};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+	typeInfo.initialValue = 0;
+
+	VkSemaphoreCreateInfo semaphoreInfo{};
+	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+	semaphoreInfo.pNext = &typeInfo;
+
+	Vk::Check(vkCreateSemaphore(m_VkDevice, &semaphoreInfo, nullptr, &m_Semaphore));
+}
+
+void GpuTimeline::Destroy()
+{
+	vkDestroySemaphore(m_VkDevice, m_Semaphore, nullptr);
+	m_Semaphore = VK_NULL_HANDLE;
+}
+
+bool GpuTimeline::IsComplete(uint64_t value)
+{
+	return value <= m_Completed || value <= Completed();
+}
+
+void GpuTimeline::Wait(uint64_t value)
+{
+	if (value <= m_Completed)
+	{
+		return;
+	}
+
+	VkSemaphoreWaitInfo waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &m_Semaphore;
+	waitInfo.pValues = &value;
+
+	Vk::Check(vkWaitSemaphores(m_VkDevice, &waitInfo, UINT64_MAX));
+	m_Completed = value;
+}
+
+uint64_t GpuTimeline::Completed()
+{
+	uint64_t value;
+	Vk::Check(vkGetSemaphoreCounterValue(m_VkDevice, m_Semaphore, &value));
+	m_Completed = value;
+	return value;
+}
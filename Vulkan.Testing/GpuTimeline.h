@@ -0,0 +1,33 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+// One timeline semaphore whose value only grows, every submission that signals it gets the next value.
+// A value identifies a point in GPU work, anything tagged with it is safe to touch once it completed.
+class GpuTimeline
+{
+public:
+	GpuTimeline();
+	virtual ~GpuTimeline();
+
+	void Create(VkDevice device);
+	void Destroy();
+
+	// Reserves the value the next submission signals
+	uint64_t Next() { return ++m_Submitted; }
+
+	// Cheap when the answer is already known, otherwise a single counter query
+	bool IsComplete(uint64_t value);
+	void Wait(uint64_t value);
+	uint64_t Completed();
+
+	constexpr uint64_t Submitted() const { return m_Submitted; }
+	constexpr VkSemaphore Semaphore() const { return m_Semaphore; }
+
+private:
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	VkSemaphore m_Semaphore = VK_NULL_HANDLE;
+
+	uint64_t m_Submitted = 0;
+	uint64_t m_Completed = 0;
+};
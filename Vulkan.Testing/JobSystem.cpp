@@ -0,0 +1,107 @@
+#include "JobSystem.h"
+#include <algorithm>
+
+JobSystem::JobSystem(uint32_t workerCount)
+{
+	if (workerCount == 0)
+	{
+		// hardware_concurrency may report 0 when it can't tell
+		workerCount = std::max(2u, std::thread::hardware_concurrency()) - 1;
+	}
+
+	m_WorkerCount = workerCount;
+	for (uint32_t i = 0; i < m_WorkerCount; i++)
+	{
+		m_Threads.emplace_back(&JobSystem::Run, this, i);
+	}
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Running = false;
+	}
+
+	m_Wake.notify_all();
+	for (auto& thread : m_Threads)
+	{
+		thread.join();
+	}
+}
+
+void JobSystem::Dispatch(uint32_t count, const std::function<void(uint32_t, uint32_t)>& job)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Job = &job;
+		m_Count = count;
+		m_Active = m_WorkerCount;
+		m_Next.store(0);
+		m_Exception = nullptr;
+		m_Generation++;
+	}
+
+	m_Wake.notify_all();
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Done.wait(lock, [this] { return m_Active == 0; });
+
+	// Surface the first failure on the calling thread
+	if (m_Exception)
+	{
+		std::rethrow_exception(m_Exception);
+	}
+}
+
+void JobSystem::Run(uint32_t worker)
+{
+	uint64_t generation = 0;
+	while (true)
+	{
+		const std::function<void(uint32_t, uint32_t)>* job = nullptr;
+		uint32_t count = 0;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Wake.wait(lock, [&] { return !m_Running || m_Generation != generation; });
+			if (!m_Running)
+			{
+				return;
+			}
+
+			generation = m_Generation;
+			job = m_Job;
+			count = m_Count;
+		}
+
+		// Pull indices until the dispatch is drained
+		try
+		{
+			for (uint32_t i = m_Next.fetch_add(1); i < count; i = m_Next.fetch_add(1))
+			{
+				(*job)(i, worker);
+			}
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (!m_Exception)
+			{
+				m_Exception = std::current_exception();
+			}
+
+			m_Next.store(count);
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_Active == 0)
+		{
+			m_Done.notify_one();
+		}
+	}
+}
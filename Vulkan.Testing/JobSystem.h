@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class JobSystem
+{
+public:
+	// Zero workers picks one per hardware thread, leaving one for the caller
+	JobSystem(uint32_t workerCount = 0);
+	virtual ~JobSystem();
+
+	// Runs job(index, worker) for every index in [0, count) and waits until all of them finished.
+	// The worker index is stable per thread so jobs can use it to pick per-thread resources.
+	void Dispatch(uint32_t count, const std::function<void(uint32_t, uint32_t)>& job);
+
+	constexpr uint32_t WorkerCount() const { return m_WorkerCount; }
+
+private:
+	void Run(uint32_t worker);
+
+	uint32_t m_WorkerCount = 0;
+	std::vector<std::thread> m_Threads;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	std::condition_variable m_Done;
+	bool m_Running = true;
+	uint64_t m_Generation = 0;
+
+	// Current dispatch
+	const std::function<void(uint32_t, uint32_t)>* m_Job = nullptr;
+	uint32_t m_Count = 0;
+	uint32_t m_Active = 0;
+	std::atomic<uint32_t> m_Next = 0;
+	std::exception_ptr m_Exception;
+};
@@ -0,0 +1,147 @@
+#include "Ktx2.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	const uint8_t IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+	struct Header
+	{
+		uint8_t Identifier[12];
+		uint32_t Format;
+		uint32_t TypeSize;
+		uint32_t PixelWidth;
+		uint32_t PixelHeight;
+		uint32_t PixelDepth;
+		uint32_t LayerCount;
+		uint32_t FaceCount;
+		uint32_t LevelCount;
+		uint32_t SupercompressionScheme;
+
+		// Index
+		uint32_t DfdByteOffset;
+		uint32_t DfdByteLength;
+		uint32_t KvdByteOffset;
+		uint32_t KvdByteLength;
+		uint64_t SgdByteOffset;
+		uint64_t SgdByteLength;
+	};
+
+	// Follows the header, one per level with level 0 first. The data itself is stored smallest level first
+	struct LevelIndex
+	{
+		uint64_t ByteOffset;
+		uint64_t ByteLength;
+		uint64_t UncompressedByteLength;
+	};
+}
+
+namespace Ktx2
+{
+	bool FormatInfo(VkFormat format, VkExtent2D& blockExtent, uint32_t& blockSize)
+	{
+		switch (format)
+		{
+		case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+		case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+		case VK_FORMAT_BC4_UNORM_BLOCK:
+		case VK_FORMAT_BC4_SNORM_BLOCK:
+			blockExtent = { 4, 4 };
+			blockSize = 8;
+			return true;
+
+		case VK_FORMAT_BC2_UNORM_BLOCK:
+		case VK_FORMAT_BC2_SRGB_BLOCK:
+		case VK_FORMAT_BC3_UNORM_BLOCK:
+		case VK_FORMAT_BC3_SRGB_BLOCK:
+		case VK_FORMAT_BC5_UNORM_BLOCK:
+		case VK_FORMAT_BC5_SNORM_BLOCK:
+		case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+		case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+		case VK_FORMAT_BC7_UNORM_BLOCK:
+		case VK_FORMAT_BC7_SRGB_BLOCK:
+			blockExtent = { 4, 4 };
+			blockSize = 16;
+			return true;
+
+		case VK_FORMAT_R8G8B8A8_UNORM:
+		case VK_FORMAT_R8G8B8A8_SRGB:
+		case VK_FORMAT_B8G8R8A8_UNORM:
+		case VK_FORMAT_B8G8R8A8_SRGB:
+			blockExtent = { 1, 1 };
+			blockSize = 4;
+			return true;
+
+		default:
+			return false;
+		}
+	}
+
+	bool Parse(const uint8_t* data, size_t size, Texture& texture, std::string& error)
+	{
+		Header header;
+		if (size < sizeof(Header) || std::memcmp(data, IDENTIFIER, sizeof(IDENTIFIER)) != 0)
+		{
+			error = "not a KTX2 file";
+			return false;
+		}
+
+		std::memcpy(&header, data, sizeof(Header));
+		if (header.PixelWidth == 0 || header.PixelHeight == 0 || header.PixelDepth > 1 || header.LayerCount > 1 || header.FaceCount != 1)
+		{
+			error = "only single 2D images are supported";
+			return false;
+		}
+
+		// Zstandard and BasisLZ need a transcoder first
+		if (header.SupercompressionScheme != 0)
+		{
+			error = "supercompression scheme " + std::to_string(header.SupercompressionScheme) + " is not supported";
+			return false;
+		}
+
+		texture.Format = (VkFormat)header.Format;
+		if (!FormatInfo(texture.Format, texture.BlockExtent, texture.BlockSize))
+		{
+			error = "format " + std::to_string(header.Format) + " is not supported";
+			return false;
+		}
+
+		// Zero levels asks the loader to generate them, there is nothing to generate with here so only the base is used
+		auto levelCount = std::max(1u, header.LevelCount);
+		if ((size - sizeof(Header)) / sizeof(LevelIndex) < levelCount || levelCount > 32)
+		{
+			error = "truncated level index";
+			return false;
+		}
+
+		texture.Width = header.PixelWidth;
+		texture.Height = header.PixelHeight;
+		texture.Levels.resize(levelCount);
+		for (uint32_t i = 0; i < levelCount; i++)
+		{
+			LevelIndex index;
+			std::memcpy(&index, data + sizeof(Header) + i * sizeof(LevelIndex), sizeof(LevelIndex));
+
+			auto& level = texture.Levels[i];
+			level.Width = std::max(1u, texture.Width >> i);
+			level.Height = std::max(1u, texture.Height >> i);
+
+			auto blocksX = (uint64_t)(level.Width + texture.BlockExtent.width - 1) / texture.BlockExtent.width;
+			auto blocksY = (uint64_t)(level.Height + texture.BlockExtent.height - 1) / texture.BlockExtent.height;
+			if (index.ByteLength != blocksX * blocksY * texture.BlockSize || index.ByteOffset > size || index.ByteLength > size - index.ByteOffset)
+			{
+				error = "level " + std::to_string(i) + " is out of bounds";
+				return false;
+			}
+
+			level.Data = data + index.ByteOffset;
+			level.Size = (size_t)index.ByteLength;
+		}
+
+		return true;
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Ktx2
+{
+	// One mip level, pointing straight into the file
+	struct Level
+	{
+		const uint8_t* Data = nullptr;
+		size_t Size = 0;
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+	};
+
+	// Level 0 is the most detailed one. Compressed formats are described in texel blocks, plain ones as 1x1 blocks
+	struct Texture
+	{
+		VkFormat Format = VK_FORMAT_UNDEFINED;
+		uint32_t Width = 0;
+		uint32_t Height = 0;
+		VkExtent2D BlockExtent{ 1, 1 };
+		uint32_t BlockSize = 0;
+		std::vector<Level> Levels;
+	};
+
+	// BCn and 8 bit RGBA formats
+	bool FormatInfo(VkFormat format, VkExtent2D& blockExtent, uint32_t& blockSize);
+
+	// 2D textures without supercompression, arrays, cube maps and 3D textures are rejected.
+	// Every level is checked against the file size and its block count, so uploads can trust the spans
+	bool Parse(const uint8_t* data, size_t size, Texture& texture, std::string& error);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read only mapping of a whole file. Nothing is read up front, pages are faulted in on first access
+class MappedFile
+{
+public:
+	MappedFile();
+	virtual ~MappedFile();
+
+	// Empty files fail to map like missing ones
+	bool Open(const std::string& path);
+	void Close();
+
+	constexpr const uint8_t* Data() const { return m_Data; }
+	constexpr size_t Size() const { return m_Size; }
+	constexpr bool IsOpen() const { return m_Data != nullptr; }
+
+private:
+	const uint8_t* m_Data = nullptr;
+	size_t m_Size = 0;
+};
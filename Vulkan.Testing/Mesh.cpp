@@ -0,0 +1,119 @@
+#include "Mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+VkVertexInputBindingDescription Vertex::BindingDescription()
+{
+	VkVertexInputBindingDescription bindingDescription{};
+	bindingDescription.binding = 0;
+	bindingDescription.stride = sizeof(Vertex);
+	bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+	return bindingDescription;
+}
+
+std::array<VkVertexInputAttributeDescription, 2> Vertex::AttributeDescriptions()
+{
+	std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+	attributeDescriptions[0].binding = 0;
+	attributeDescriptions[0].location = 0;
+	attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+	attributeDescriptions[0].offset = offsetof(Vertex, Position);
+
+	attributeDescriptions[1].binding = 0;
+	attributeDescriptions[1].location = 1;
+	attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+	attributeDescriptions[1].offset = offsetof(Vertex, Color);
+	return attributeDescriptions;
+}
+
+namespace Mesh
+{
+	MeshData CreateTriangle()
+	{
+		MeshData mesh;
+		mesh.Vertices =
+		{
+			{ { 0.0f, -0.5f, 0.0f }, { 1.0f, 0.0f, 0.0f } },
+			{ { 0.5f, 0.5f, 0.0f }, { 0.0f, 1.0f, 0.0f } },
+			{ { -0.5f, 0.5f, 0.0f }, { 0.0f, 0.0f, 1.0f } },
+		};
+
+		mesh.Indices = { 0, 1, 2 };
+		return mesh;
+	}
+
+	MeshData CreateGrid(uint32_t triangleCount)
+	{
+		// Two triangles per cell on a square grid
+		auto cells = std::max(1u, (uint32_t)std::sqrt(triangleCount / 2.0));
+		auto stride = cells + 1;
+
+		MeshData mesh;
+		mesh.Vertices.reserve((size_t)stride * stride);
+		mesh.Indices.reserve((size_t)cells * cells * 6);
+
+		for (uint32_t y = 0; y < stride; y++)
+		{
+			for (uint32_t x = 0; x < stride; x++)
+			{
+				auto u = (float)x / cells;
+				auto v = (float)y / cells;
+
+				Vertex vertex = { { u * 1.8f - 0.9f, v * 1.8f - 0.9f, 0.0f }, { u, v, 1.0f - u } };
+				mesh.Vertices.push_back(vertex);
+			}
+		}
+
+		// Clockwise winding to match the pipeline's front face
+		for (uint32_t y = 0; y < cells; y++)
+		{
+			for (uint32_t x = 0; x < cells; x++)
+			{
+				auto i = y * stride + x;
+				mesh.Indices.insert(mesh.Indices.end(), { i, i + 1, i + stride, i + 1, i + stride + 1, i + stride });
+			}
+		}
+
+		return mesh;
+	}
+
+	float BoundingRadius(const MeshData& mesh)
+	{
+		auto radius = 0.0f;
+		for (const auto& vertex : mesh.Vertices)
+		{
+			auto x = vertex.Position[0], y = vertex.Position[1], z = vertex.Position[2];
+			radius = std::max(radius, std::sqrt(x * x + y * y + z * z));
+		}
+
+		return radius;
+	}
+
+	std::vector<InstanceData> CreateInstanceGrid(uint32_t count)
+	{
+		auto side = std::max(1u, (uint32_t)std::ceil(std::sqrt((double)count)));
+		auto cell = 2.0f / side;
+
+		std::vector<InstanceData> instances(count);
+		for (uint32_t i = 0; i < count; i++)
+		{
+			auto x = i % side;
+			auto y = i / side;
+
+			// Meshes span about [-0.9, 0.9], half a cell keeps neighbours apart
+			auto& instance = instances[i];
+			instance.Offset[0] = -1.0f + (x + 0.5f) * cell;
+			instance.Offset[1] = -1.0f + (y + 0.5f) * cell;
+			instance.Scale = count == 1 ? 1.0f : cell * 0.5f;
+			instance.Padding = 0.0f;
+
+			instance.Color[0] = 0.5f + 0.5f * (float)x / side;
+			instance.Color[1] = 0.5f + 0.5f * (float)y / side;
+			instance.Color[2] = 1.0f;
+			instance.Color[3] = 1.0f;
+		}
+
+		return instances;
+	}
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+struct Vertex
+{
+	float Position[3];
+	float Color[3];
+
+	static VkVertexInputBindingDescription BindingDescription();
+	static std::array<VkVertexInputAttributeDescription, 2> AttributeDescriptions();
+};
+
+// Per object data read by the vertex shader through gl_InstanceIndex, two vec4 in std430
+struct InstanceData
+{
+	float Offset[2];
+	float Scale;
+	float Padding;
+	float Color[4];
+};
+
+struct MeshData
+{
+	std::vector<Vertex> Vertices;
+	std::vector<uint32_t> Indices;
+};
+
+namespace Mesh
+{
+	// The triangle the vertex shader used to hard code
+	MeshData CreateTriangle();
+
+	// A screen filling grid of roughly triangleCount triangles, for stressing uploads and vertex throughput
+	MeshData CreateGrid(uint32_t triangleCount);
+
+	// Radius of the smallest sphere around the origin that holds every vertex
+	float BoundingRadius(const MeshData& mesh);
+
+	// Lays count copies of a mesh out on a screen filling grid, each with its own tint
+	std::vector<InstanceData> CreateInstanceGrid(uint32_t count);
+}
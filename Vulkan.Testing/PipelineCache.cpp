@@ -0,0 +1,183 @@
+#include "PipelineCache.h"
+#include "VkUtils.h"
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstring>
+
+namespace
+{
+	const uint32_t CACHE_FILE_MAGIC = 0x43504B56; // "VKPC"
+	const uint32_t CACHE_FILE_VERSION = 1;
+
+	// Written in front of the driver blob so truncated or foreign files are rejected before the driver sees them
+	struct CacheFileHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint64_t DataSize;
+		uint64_t DataHash;
+		double ColdCreationTime;
+	};
+}
+
+PipelineCache::PipelineCache(const std::string& path) : m_Path(path)
+{
+}
+
+PipelineCache::~PipelineCache()
+{
+}
+
+void PipelineCache::Load(VkPhysicalDevice physicalDevice, VkDevice device)
+{
+	m_VkDevice = device;
+	vkGetPhysicalDeviceProperties(physicalDevice, &m_Properties);
+
+	// Read the blob from disk
+	std::vector<char> data;
+	std::ifstream file(m_Path, std::ios::binary);
+	if (file.is_open())
+	{
+		CacheFileHeader header{};
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+
+		if (file && header.Magic == CACHE_FILE_MAGIC && header.Version == CACHE_FILE_VERSION)
+		{
+			// The blob has to fit in what is left of the file, a corrupt size would otherwise be allocated as is
+			auto dataStart = file.tellg();
+			file.seekg(0, std::ios::end);
+			auto remaining = (uint64_t)(file.tellg() - dataStart);
+			file.seekg(dataStart);
+
+			bool fits = file && header.DataSize <= remaining;
+			if (fits)
+			{
+				data.resize((size_t)header.DataSize);
+				file.read(data.data(), data.size());
+			}
+
+			if (!fits || !file || Vk::Hash(data.data(), data.size()) != header.DataHash || !ValidateHeader(data))
+			{
+				std::cout << "Pipeline cache " << m_Path << " is stale or corrupt, starting cold\n";
+				data.clear();
+			}
+			else
+			{
+				m_ColdCreationTime = header.ColdCreationTime;
+			}
+		}
+	}
+
+	m_Warm = !data.empty();
+
+	// Create the cache
+	VkPipelineCacheCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = data.size();
+	createInfo.pInitialData = data.size() ? data.data() : nullptr;
+
+	Vk::Check(vkCreatePipelineCache(m_VkDevice, &createInfo, nullptr, &m_VkPipelineCache));
+}
+
+bool PipelineCache::ValidateHeader(const std::vector<char>& data) const
+{
+	// VkPipelineCacheHeaderVersionOne: headerSize, headerVersion, vendorID, deviceID, pipelineCacheUUID
+	const size_t headerSize = 16 + VK_UUID_SIZE;
+	if (data.size() < headerSize)
+	{
+		return false;
+	}
+
+	uint32_t fields[4];
+	std::memcpy(fields, data.data(), sizeof(fields));
+
+	if (fields[0] < headerSize || fields[1] != VK_PIPELINE_CACHE_HEADER_VERSION_ONE)
+	{
+		return false;
+	}
+
+	if (fields[2] != m_Properties.vendorID || fields[3] != m_Properties.deviceID)
+	{
+		return false;
+	}
+
+	return std::memcmp(data.data() + 16, m_Properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void PipelineCache::Save()
+{
+	if (m_VkPipelineCache == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	size_t dataSize = 0;
+	Vk::Check(vkGetPipelineCacheData(m_VkDevice, m_VkPipelineCache, &dataSize, nullptr));
+
+	std::vector<char> data(dataSize);
+	Vk::Check(vkGetPipelineCacheData(m_VkDevice, m_VkPipelineCache, &dataSize, data.data()));
+	data.resize(dataSize);
+
+	// Only a cold run measures the full compile cost
+	CacheFileHeader header{};
+	header.Magic = CACHE_FILE_MAGIC;
+	header.Version = CACHE_FILE_VERSION;
+	header.DataSize = data.size();
+	header.DataHash = Vk::Hash(data.data(), data.size());
+	header.ColdCreationTime = m_Warm ? m_ColdCreationTime : m_CreationTime;
+
+	// Write next to the real file, then swap it in so a crash never leaves a half written cache
+	auto tempPath = m_Path + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		if (!file.is_open())
+		{
+			std::cout << "Could not write pipeline cache " << tempPath << '\n';
+			return;
+		}
+
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(data.data(), data.size());
+		file.flush();
+
+		if (!file)
+		{
+			std::cout << "Could not write pipeline cache " << tempPath << '\n';
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, m_Path, error);
+	if (error)
+	{
+		std::cout << "Could not replace pipeline cache " << m_Path << ": " << error.message() << '\n';
+		std::filesystem::remove(tempPath, error);
+	}
+}
+
+void PipelineCache::Destroy()
+{
+	if (m_VkPipelineCache != VK_NULL_HANDLE)
+	{
+		vkDestroyPipelineCache(m_VkDevice, m_VkPipelineCache, nullptr);
+		m_VkPipelineCache = VK_NULL_HANDLE;
+	}
+}
+
+void PipelineCache::AddCreationTime(double seconds)
+{
+	m_CreationTime += seconds;
+}
+
+void PipelineCache::Report()
+{
+	std::cout << "Pipeline cache: " << (m_Warm ? "warm" : "cold") << ", pipelines created in " << m_CreationTime * 1000.0 << " ms";
+	if (m_Warm && m_ColdCreationTime > 0.0)
+	{
+		std::cout << " (cold " << m_ColdCreationTime * 1000.0 << " ms, saved " << (m_ColdCreationTime - m_CreationTime) * 1000.0 << " ms)";
+	}
+
+	std::cout << '\n';
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+class PipelineCache
+{
+public:
+	PipelineCache(const std::string& path);
+	virtual ~PipelineCache();
+
+	// Creates the VkPipelineCache, seeded from disk when the blob matches this device
+	void Load(VkPhysicalDevice physicalDevice, VkDevice device);
+
+	// Writes the cache blob to a temporary file and renames it over the old one
+	void Save();
+	void Destroy();
+
+	// Time spent in vkCreate*Pipelines, used to report how much the cache saved
+	void AddCreationTime(double seconds);
+	void Report();
+
+	constexpr VkPipelineCache Get() const { return m_VkPipelineCache; }
+	constexpr bool IsWarm() const { return m_Warm; }
+
+private:
+	bool ValidateHeader(const std::vector<char>& data) const;
+
+	std::string m_Path;
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties m_Properties{};
+	VkPipelineCache m_VkPipelineCache = VK_NULL_HANDLE;
+
+	bool m_Warm = false;
+	double m_CreationTime = 0.0;
+	double m_ColdCreationTime = 0.0;
+};
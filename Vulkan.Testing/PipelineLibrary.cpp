@@ -0,0 +1,581 @@
+#include "PipelineLibrary.h"
+#include "VkUtils.h"
+#include "Timer.h"
+#include "Mesh.h"
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	// Create infos of one pipeline, they point into each other so a filled state must not move
+	struct PipelineState
+	{
+		VkPipelineShaderStageCreateInfo Stages[2]{};
+		VkVertexInputBindingDescription Binding{};
+		std::array<VkVertexInputAttributeDescription, 2> Attributes{};
+		VkPipelineVertexInputStateCreateInfo VertexInput{};
+		VkPipelineInputAssemblyStateCreateInfo InputAssembly{};
+		VkPipelineViewportStateCreateInfo ViewportState{};
+		VkPipelineRasterizationStateCreateInfo Rasterizer{};
+		VkPipelineMultisampleStateCreateInfo Multisampling{};
+		VkPipelineColorBlendAttachmentState BlendAttachment{};
+		VkPipelineColorBlendStateCreateInfo ColorBlending{};
+		VkPipelineDepthStencilStateCreateInfo DepthStencil{};
+		std::vector<VkDynamicState> DynamicStates;
+		VkPipelineDynamicStateCreateInfo DynamicState{};
+	};
+
+	// Dynamic topology may only switch between topologies of the same class
+	int TopologyClass(VkPrimitiveTopology topology)
+	{
+		switch (topology)
+		{
+		case VK_PRIMITIVE_TOPOLOGY_POINT_LIST:
+			return 0;
+		case VK_PRIMITIVE_TOPOLOGY_LINE_LIST:
+		case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP:
+		case VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY:
+		case VK_PRIMITIVE_TOPOLOGY_LINE_STRIP_WITH_ADJACENCY:
+			return 1;
+		case VK_PRIMITIVE_TOPOLOGY_PATCH_LIST:
+			return 3;
+		default:
+			return 2;
+		}
+	}
+}
+
+PipelineLibrary::PipelineLibrary()
+{
+}
+
+PipelineLibrary::~PipelineLibrary()
+{
+}
+
+void PipelineLibrary::Create(VkDevice device, PipelineCache* cache, const ShaderArchive* archive, DeletionQueue* deletionQueue, bool extendedDynamicState, uint32_t threadCount)
+{
+	m_VkDevice = device;
+	m_Cache = cache;
+	m_Archive = archive;
+	m_DeletionQueue = deletionQueue;
+
+	m_ExtendedDynamicState = extendedDynamicState;
+	if (m_ExtendedDynamicState)
+	{
+		m_vkCmdSetPrimitiveTopology = (PFN_vkCmdSetPrimitiveTopologyEXT)vkGetDeviceProcAddr(device, "vkCmdSetPrimitiveTopologyEXT");
+		m_vkCmdSetCullMode = (PFN_vkCmdSetCullModeEXT)vkGetDeviceProcAddr(device, "vkCmdSetCullModeEXT");
+		m_vkCmdSetFrontFace = (PFN_vkCmdSetFrontFaceEXT)vkGetDeviceProcAddr(device, "vkCmdSetFrontFaceEXT");
+		m_vkCmdSetDepthTestEnable = (PFN_vkCmdSetDepthTestEnableEXT)vkGetDeviceProcAddr(device, "vkCmdSetDepthTestEnableEXT");
+		m_vkCmdSetDepthWriteEnable = (PFN_vkCmdSetDepthWriteEnableEXT)vkGetDeviceProcAddr(device, "vkCmdSetDepthWriteEnableEXT");
+		m_vkCmdSetDepthCompareOp = (PFN_vkCmdSetDepthCompareOpEXT)vkGetDeviceProcAddr(device, "vkCmdSetDepthCompareOpEXT");
+	}
+
+	if (threadCount == 0)
+	{
+		threadCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+	}
+
+	m_Stop = false;
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		m_Threads.emplace_back(&PipelineLibrary::Run, this);
+	}
+}
+
+void PipelineLibrary::Destroy()
+{
+	// Queued batches are dropped, only the running ones finish
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+		m_Batches.clear();
+	}
+
+	m_Wake.notify_all();
+	for (auto& thread : m_Threads)
+	{
+		thread.join();
+	}
+
+	m_Threads.clear();
+
+	for (auto pipeline : m_Replaced)
+	{
+		vkDestroyPipeline(m_VkDevice, pipeline, nullptr);
+	}
+
+	m_Replaced.clear();
+
+	for (auto& module : m_Modules)
+	{
+		vkDestroyShaderModule(m_VkDevice, module.second, nullptr);
+	}
+
+	m_Modules.clear();
+	m_ModuleHashes.clear();
+	m_ReplacedModules.clear();
+
+	for (auto& entry : m_Entries)
+	{
+		if (entry.Pipeline.load() != VK_NULL_HANDLE)
+		{
+			vkDestroyPipeline(m_VkDevice, entry.Pipeline.load(), nullptr);
+		}
+	}
+
+	m_Entries.clear();
+	m_Variants.clear();
+}
+
+uint32_t PipelineLibrary::Add(const PipelineDesc& desc)
+{
+	auto entry = (uint32_t)m_Entries.size();
+	for (uint32_t i = 0; i < m_Entries.size(); i++)
+	{
+		if (SharesPipeline(m_Entries[i].Desc, desc))
+		{
+			entry = i;
+			break;
+		}
+	}
+
+	if (entry == m_Entries.size())
+	{
+		m_Entries.emplace_back();
+		m_Entries.back().Desc = desc;
+	}
+
+	m_Variants.push_back({ desc, entry });
+	return (uint32_t)m_Variants.size() - 1;
+}
+
+bool PipelineLibrary::SharesPipeline(const PipelineDesc& a, const PipelineDesc& b) const
+{
+	if (a.VertexShader != b.VertexShader || a.FragmentShader != b.FragmentShader || a.Blend != b.Blend || a.ColorWriteMask != b.ColorWriteMask)
+	{
+		return false;
+	}
+
+	if (m_ExtendedDynamicState)
+	{
+		return TopologyClass(a.Topology) == TopologyClass(b.Topology);
+	}
+
+	return a.Topology == b.Topology && a.CullMode == b.CullMode && a.FrontFace == b.FrontFace &&
+		a.DepthTest == b.DepthTest && a.DepthWrite == b.DepthWrite && a.DepthCompare == b.DepthCompare;
+}
+
+void PipelineLibrary::SetTarget(VkRenderPass renderPass, VkPipelineLayout layout, VkSampleCountFlagBits samples)
+{
+	// Running batches still reference the old render pass and layout
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Batches.clear();
+		m_Idle.wait(lock, [this] { return m_Running == 0; });
+	}
+
+	Update();
+
+	for (auto& entry : m_Entries)
+	{
+		auto pipeline = entry.Pipeline.exchange(VK_NULL_HANDLE);
+		if (pipeline != VK_NULL_HANDLE)
+		{
+			m_DeletionQueue->Retire(pipeline);
+		}
+
+		entry.Queued = false;
+	}
+
+	m_Target.RenderPass = renderPass;
+	m_Target.Layout = layout;
+	m_Target.Samples = samples;
+
+	// Nothing may ever be drawn without a pipeline
+	if (m_Fallback < m_Variants.size())
+	{
+		auto& fallback = m_Entries[m_Variants[m_Fallback].Entry];
+		Build(m_Target, { &fallback });
+		fallback.Queued = true;
+
+		if (fallback.Pipeline.load() == VK_NULL_HANDLE)
+		{
+			throw std::runtime_error("failed to create the fallback pipeline!");
+		}
+	}
+
+	Compile();
+}
+
+void PipelineLibrary::Compile()
+{
+	std::vector<Entry*> batch;
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	for (auto& entry : m_Entries)
+	{
+		if (entry.Queued)
+		{
+			continue;
+		}
+
+		entry.Queued = true;
+		batch.push_back(&entry);
+		if (batch.size() == BATCH_SIZE)
+		{
+			m_Batches.push_back(std::move(batch));
+			batch.clear();
+		}
+	}
+
+	if (!batch.empty())
+	{
+		m_Batches.push_back(std::move(batch));
+	}
+
+	m_Wake.notify_all();
+}
+
+void PipelineLibrary::Reload(const std::vector<std::string>& spirvPaths)
+{
+	for (auto& entry : m_Entries)
+	{
+		for (const auto& path : spirvPaths)
+		{
+			if (entry.Desc.VertexShader == path || entry.Desc.FragmentShader == path)
+			{
+				entry.Queued = false;
+			}
+		}
+	}
+
+	Compile();
+}
+
+void PipelineLibrary::Update()
+{
+	std::vector<VkPipeline> replaced;
+	std::vector<VkShaderModule> modules;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		replaced.swap(m_Replaced);
+
+		// A batch queued before the reload may still be creating pipelines from the old module
+		if (m_Batches.empty() && m_Running == 0)
+		{
+			for (auto hash : m_ReplacedModules)
+			{
+				// Another path with the same content, or a reload back to it, still points at the module
+				bool used = std::any_of(m_ModuleHashes.begin(), m_ModuleHashes.end(), [hash](const auto& path) { return path.second == hash; });
+				auto found = m_Modules.find(hash);
+				if (!used && found != m_Modules.end())
+				{
+					modules.push_back(found->second);
+					m_Modules.erase(found);
+				}
+			}
+
+			m_ReplacedModules.clear();
+		}
+	}
+
+	for (auto pipeline : replaced)
+	{
+		m_DeletionQueue->Retire(pipeline);
+	}
+
+	for (auto module : modules)
+	{
+		m_DeletionQueue->Retire(module);
+	}
+}
+
+void PipelineLibrary::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_Idle.wait(lock, [this] { return m_Batches.empty() && m_Running == 0; });
+}
+
+VkPipeline PipelineLibrary::Get(uint32_t handle) const
+{
+	auto pipeline = m_Entries[m_Variants[handle].Entry].Pipeline.load();
+	return pipeline != VK_NULL_HANDLE ? pipeline : m_Entries[m_Variants[m_Fallback].Entry].Pipeline.load();
+}
+
+bool PipelineLibrary::IsReady(uint32_t handle) const
+{
+	return m_Entries[m_Variants[handle].Entry].Pipeline.load() != VK_NULL_HANDLE;
+}
+
+uint32_t PipelineLibrary::ReadyCount() const
+{
+	return (uint32_t)std::count_if(m_Entries.begin(), m_Entries.end(), [](const Entry& entry) { return entry.Pipeline.load() != VK_NULL_HANDLE; });
+}
+
+void PipelineLibrary::Bind(VkCommandBuffer commandBuffer, uint32_t handle, PipelineBinding& bound) const
+{
+	auto pipeline = Get(handle);
+	if (pipeline != bound.Pipeline)
+	{
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		bound.Pipeline = pipeline;
+	}
+
+	if (!m_ExtendedDynamicState)
+	{
+		return;
+	}
+
+	// Every pipeline of the library declares the same dynamic state, so it carries over between binds
+	const auto& desc = m_Variants[handle].Desc;
+	const auto* last = bound.State;
+	if (last == nullptr || last->Topology != desc.Topology)
+	{
+		m_vkCmdSetPrimitiveTopology(commandBuffer, desc.Topology);
+	}
+
+	if (last == nullptr || last->CullMode != desc.CullMode)
+	{
+		m_vkCmdSetCullMode(commandBuffer, desc.CullMode);
+	}
+
+	if (last == nullptr || last->FrontFace != desc.FrontFace)
+	{
+		m_vkCmdSetFrontFace(commandBuffer, desc.FrontFace);
+	}
+
+	if (last == nullptr || last->DepthTest != desc.DepthTest)
+	{
+		m_vkCmdSetDepthTestEnable(commandBuffer, desc.DepthTest ? VK_TRUE : VK_FALSE);
+	}
+
+	if (last == nullptr || last->DepthWrite != desc.DepthWrite)
+	{
+		m_vkCmdSetDepthWriteEnable(commandBuffer, desc.DepthWrite ? VK_TRUE : VK_FALSE);
+	}
+
+	if (last == nullptr || last->DepthCompare != desc.DepthCompare)
+	{
+		m_vkCmdSetDepthCompareOp(commandBuffer, desc.DepthCompare);
+	}
+
+	bound.State = &desc;
+}
+
+void PipelineLibrary::Run()
+{
+	while (true)
+	{
+		std::vector<Entry*> batch;
+		Target target;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Wake.wait(lock, [this] { return m_Stop || !m_Batches.empty(); });
+			if (m_Stop)
+			{
+				return;
+			}
+
+			batch = std::move(m_Batches.front());
+			m_Batches.pop_front();
+			target = m_Target;
+			m_Running++;
+		}
+
+		// A failed batch leaves its variants on the fallback instead of taking the renderer down
+		try
+		{
+			Build(target, batch);
+		}
+		catch (const std::exception& e)
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			std::cout << "Pipeline batch failed: " << e.what() << '\n';
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_Running == 0 && m_Batches.empty())
+		{
+			m_Idle.notify_all();
+		}
+	}
+}
+
+VkShaderModule PipelineLibrary::ShaderModule(const std::string& path)
+{
+	std::vector<uint32_t> storage;
+	auto spirv = m_Archive->Load(path, storage);
+
+	// Keyed by content, variants that share a shader share the module and a reload creates a new one
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	auto& current = m_ModuleHashes[path];
+	if (current != 0 && current != spirv.Hash)
+	{
+		m_ReplacedModules.push_back(current);
+	}
+
+	current = spirv.Hash;
+	auto found = m_Modules.find(spirv.Hash);
+	if (found != m_Modules.end())
+	{
+		return found->second;
+	}
+
+	VkShaderModuleCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	createInfo.codeSize = spirv.Size;
+	createInfo.pCode = spirv.Code;
+
+	VkShaderModule shaderModule;
+	Vk::Check(vkCreateShaderModule(m_VkDevice, &createInfo, nullptr, &shaderModule));
+	m_Modules[spirv.Hash] = shaderModule;
+	return shaderModule;
+}
+
+void PipelineLibrary::Build(const Target& target, const std::vector<Entry*>& batch)
+{
+	std::vector<PipelineState> states(batch.size());
+	std::vector<VkGraphicsPipelineCreateInfo> createInfos(batch.size());
+	for (size_t i = 0; i < batch.size(); i++)
+	{
+		const auto& desc = batch[i]->Desc;
+		auto& state = states[i];
+
+		// Shaders
+		state.Stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		state.Stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+		state.Stages[0].module = ShaderModule(desc.VertexShader);
+		state.Stages[0].pName = "main";
+
+		state.Stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+		state.Stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+		state.Stages[1].module = ShaderModule(desc.FragmentShader);
+		state.Stages[1].pName = "main";
+
+		// Vertex input
+		state.Binding = Vertex::BindingDescription();
+		state.Attributes = Vertex::AttributeDescriptions();
+
+		state.VertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+		state.VertexInput.vertexBindingDescriptionCount = 1;
+		state.VertexInput.pVertexBindingDescriptions = &state.Binding;
+		state.VertexInput.vertexAttributeDescriptionCount = (uint32_t)state.Attributes.size();
+		state.VertexInput.pVertexAttributeDescriptions = state.Attributes.data();
+
+		// Input assembler
+		state.InputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+		state.InputAssembly.topology = desc.Topology;
+		state.InputAssembly.primitiveRestartEnable = VK_FALSE;
+
+		// Viewport, both set while recording
+		state.ViewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+		state.ViewportState.viewportCount = 1;
+		state.ViewportState.scissorCount = 1;
+
+		// Rasterizer
+		state.Rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+		state.Rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+		state.Rasterizer.lineWidth = 1.0f;
+		state.Rasterizer.cullMode = desc.CullMode;
+		state.Rasterizer.frontFace = desc.FrontFace;
+
+		// Multisampling
+		state.Multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+		state.Multisampling.rasterizationSamples = target.Samples;
+		state.Multisampling.minSampleShading = 1.0f;
+
+		// Color blending, alpha blending when the variant asks for it
+		state.BlendAttachment.colorWriteMask = desc.ColorWriteMask;
+		state.BlendAttachment.blendEnable = desc.Blend ? VK_TRUE : VK_FALSE;
+		state.BlendAttachment.srcColorBlendFactor = desc.Blend ? VK_BLEND_FACTOR_SRC_ALPHA : VK_BLEND_FACTOR_ONE;
+		state.BlendAttachment.dstColorBlendFactor = desc.Blend ? VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA : VK_BLEND_FACTOR_ZERO;
+		state.BlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+		state.BlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+		state.BlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+		state.BlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+		state.ColorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+		state.ColorBlending.logicOp = VK_LOGIC_OP_COPY;
+		state.ColorBlending.attachmentCount = 1;
+		state.ColorBlending.pAttachments = &state.BlendAttachment;
+
+		// Depth, ignored by render passes without a depth attachment
+		state.DepthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+		state.DepthStencil.depthTestEnable = desc.DepthTest ? VK_TRUE : VK_FALSE;
+		state.DepthStencil.depthWriteEnable = desc.DepthWrite ? VK_TRUE : VK_FALSE;
+		state.DepthStencil.depthCompareOp = desc.DepthCompare;
+		state.DepthStencil.maxDepthBounds = 1.0f;
+
+		// Dynamic state, what Bind sets instead of the pipeline
+		state.DynamicStates = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+		if (m_ExtendedDynamicState)
+		{
+			state.DynamicStates.insert(state.DynamicStates.end(), {
+				VK_DYNAMIC_STATE_PRIMITIVE_TOPOLOGY_EXT,
+				VK_DYNAMIC_STATE_CULL_MODE_EXT,
+				VK_DYNAMIC_STATE_FRONT_FACE_EXT,
+				VK_DYNAMIC_STATE_DEPTH_TEST_ENABLE_EXT,
+				VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT,
+				VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT
+			});
+		}
+
+		state.DynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+		state.DynamicState.dynamicStateCount = (uint32_t)state.DynamicStates.size();
+		state.DynamicState.pDynamicStates = state.DynamicStates.data();
+
+		// Create info
+		auto& pipelineInfo = createInfos[i];
+		pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+		pipelineInfo.stageCount = 2;
+		pipelineInfo.pStages = state.Stages;
+		pipelineInfo.pVertexInputState = &state.VertexInput;
+		pipelineInfo.pInputAssemblyState = &state.InputAssembly;
+		pipelineInfo.pViewportState = &state.ViewportState;
+		pipelineInfo.pRasterizationState = &state.Rasterizer;
+		pipelineInfo.pMultisampleState = &state.Multisampling;
+		pipelineInfo.pDepthStencilState = &state.DepthStencil;
+		pipelineInfo.pColorBlendState = &state.ColorBlending;
+		pipelineInfo.pDynamicState = &state.DynamicState;
+		pipelineInfo.layout = target.Layout;
+		pipelineInfo.renderPass = target.RenderPass;
+		pipelineInfo.subpass = 0;
+		pipelineInfo.basePipelineIndex = -1;
+	}
+
+	// One call for the whole batch, the driver can spread it over its own threads
+	std::vector<VkPipeline> pipelines(batch.size(), VK_NULL_HANDLE);
+
+	Timer timer;
+	timer.Start();
+
+	auto result = vkCreateGraphicsPipelines(m_VkDevice, m_Cache->Get(), (uint32_t)createInfos.size(), createInfos.data(), nullptr, pipelines.data());
+	timer.Tick();
+
+	// A failed call may still have created some of the pipelines
+	if (result != VK_SUCCESS)
+	{
+		for (auto pipeline : pipelines)
+		{
+			if (pipeline != VK_NULL_HANDLE)
+			{
+				vkDestroyPipeline(m_VkDevice, pipeline, nullptr);
+			}
+		}
+
+		Vk::Check(result);
+	}
+
+	// Publishing is atomic, the replaced pipeline may still be recorded by the main thread right now
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	m_Cache->AddCreationTime(timer.TotalTime());
+	for (size_t i = 0; i < batch.size(); i++)
+	{
+		auto replaced = batch[i]->Pipeline.exchange(pipelines[i]);
+		if (replaced != VK_NULL_HANDLE)
+		{
+			m_Replaced.push_back(replaced);
+		}
+	}
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "PipelineCache.h"
+#include "DeletionQueue.h"
+#include "ShaderArchive.h"
+
+// Everything that differs between two graphics pipelines of the scene. With extended dynamic state
+// the topology, rasterizer and depth fields are set while recording and no longer need their own pipeline
+struct PipelineDesc
+{
+	std::string VertexShader = "shaders/vert.spv";
+	std::string FragmentShader = "shaders/frag.spv";
+	VkPrimitiveTopology Topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkCullModeFlags CullMode = VK_CULL_MODE_BACK_BIT;
+	VkFrontFace FrontFace = VK_FRONT_FACE_CLOCKWISE;
+	bool DepthTest = false;
+	bool DepthWrite = false;
+	VkCompareOp DepthCompare = VK_COMPARE_OP_LESS_OR_EQUAL;
+	bool Blend = false;
+	VkColorComponentFlags ColorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+};
+
+// What a command buffer has bound so far, start every command buffer with a fresh one
+struct PipelineBinding
+{
+	VkPipeline Pipeline = VK_NULL_HANDLE;
+	const PipelineDesc* State = nullptr;
+};
+
+// Compiles graphics pipelines on background threads, several per vkCreateGraphicsPipelines call and all
+// through the shared pipeline cache. Until a pipeline is ready its users get the fallback pipeline,
+// which is always compiled on the calling thread so there is something to draw with from the first frame.
+class PipelineLibrary
+{
+public:
+	static const uint32_t BATCH_SIZE = 8;
+
+	PipelineLibrary();
+	virtual ~PipelineLibrary();
+
+	// Zero threads picks half of the hardware threads. Extended dynamic state needs VK_EXT_extended_dynamic_state enabled
+	void Create(VkDevice device, PipelineCache* cache, const ShaderArchive* archive, DeletionQueue* deletionQueue, bool extendedDynamicState, uint32_t threadCount = 0);
+	void Destroy();
+
+	// Registers a variant, it shares a pipeline with every earlier variant that differs only in dynamic state.
+	// Nothing is compiled until the next Compile
+	uint32_t Add(const PipelineDesc& desc);
+
+	// State every variant is built against, viewport and scissor are dynamic so a resize does not change it.
+	// Waits for running batches, retires all pipelines and compiles the fallback right away, the other
+	// variants go back into the background queue
+	void SetTarget(VkRenderPass renderPass, VkPipelineLayout layout, VkSampleCountFlagBits samples);
+	void SetFallback(uint32_t handle) { m_Fallback = handle; }
+
+	// Queues every variant that is neither ready nor queued yet
+	void Compile();
+
+	// Rebuilds the variants that use one of these SPIR-V files, they keep their old pipeline until the new one is ready
+	void Reload(const std::vector<std::string>& spirvPaths);
+
+	// Hands pipelines replaced by a reload to the deletion queue, call once per frame before recording. Replaced
+	// shader modules follow once no batch is left that could still be building from them
+	void Update();
+
+	// Blocks until the background queue is empty
+	void WaitIdle();
+
+	// The variant when it is ready, the fallback otherwise
+	VkPipeline Get(uint32_t handle) const;
+	bool IsReady(uint32_t handle) const;
+	uint32_t ReadyCount() const;
+
+	// Binds the variant's pipeline and the dynamic state it expects, skipping whatever is bound already
+	void Bind(VkCommandBuffer commandBuffer, uint32_t handle, PipelineBinding& bound) const;
+
+	uint32_t VariantCount() const { return (uint32_t)m_Variants.size(); }
+	uint32_t PipelineCount() const { return (uint32_t)m_Entries.size(); }
+
+private:
+	struct Entry
+	{
+		PipelineDesc Desc;
+		std::atomic<VkPipeline> Pipeline{ VK_NULL_HANDLE };
+		bool Queued = false;
+	};
+
+	struct Variant
+	{
+		PipelineDesc Desc;
+		uint32_t Entry;
+	};
+
+	struct Target
+	{
+		VkRenderPass RenderPass = VK_NULL_HANDLE;
+		VkPipelineLayout Layout = VK_NULL_HANDLE;
+		VkSampleCountFlagBits Samples = VK_SAMPLE_COUNT_1_BIT;
+	};
+
+	void Run();
+	void Build(const Target& target, const std::vector<Entry*>& batch);
+	bool SharesPipeline(const PipelineDesc& a, const PipelineDesc& b) const;
+	VkShaderModule ShaderModule(const std::string& path);
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	PipelineCache* m_Cache = nullptr;
+	const ShaderArchive* m_Archive = nullptr;
+	DeletionQueue* m_DeletionQueue = nullptr;
+
+	// Modules by content hash, a reload replaces the one its path pointed at
+	std::unordered_map<uint64_t, VkShaderModule> m_Modules;
+	std::unordered_map<std::string, uint64_t> m_ModuleHashes;
+
+	// Entries never move, workers hold pointers into the deque
+	std::deque<Entry> m_Entries;
+	std::vector<Variant> m_Variants;
+	uint32_t m_Fallback = 0;
+
+	// VK_EXT_extended_dynamic_state
+	bool m_ExtendedDynamicState = false;
+	PFN_vkCmdSetPrimitiveTopologyEXT m_vkCmdSetPrimitiveTopology = nullptr;
+	PFN_vkCmdSetCullModeEXT m_vkCmdSetCullMode = nullptr;
+	PFN_vkCmdSetFrontFaceEXT m_vkCmdSetFrontFace = nullptr;
+	PFN_vkCmdSetDepthTestEnableEXT m_vkCmdSetDepthTestEnable = nullptr;
+	PFN_vkCmdSetDepthWriteEnableEXT m_vkCmdSetDepthWriteEnable = nullptr;
+	PFN_vkCmdSetDepthCompareOpEXT m_vkCmdSetDepthCompareOp = nullptr;
+	Target m_Target;
+
+	// Background compilation
+	std::vector<std::thread> m_Threads;
+	mutable std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	std::condition_variable m_Idle;
+	std::deque<std::vector<Entry*>> m_Batches;
+	std::vector<VkPipeline> m_Replaced;
+	std::vector<uint64_t> m_ReplacedModules;
+	uint32_t m_Running = 0;
+	bool m_Stop = false;
+};
@@ -0,0 +1,832 @@
+#include "RenderGraph.h"
+#include "VkUtils.h"
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+		VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+	bool HasStencil(VkFormat format)
+	{
+		return format == VK_FORMAT_S8_UINT || format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+	}
+
+	bool IsDepth(VkFormat format)
+	{
+		return HasStencil(format) || format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 || format == VK_FORMAT_D32_SFLOAT;
+	}
+}
+
+RenderGraph::RenderGraph()
+{
+}
+
+RenderGraph::~RenderGraph()
+{
+}
+
+void RenderGraph::Create(VkDevice device, GpuAllocator* allocator, DeletionQueue* deletionQueue)
+{
+	m_VkDevice = device;
+	m_Allocator = allocator;
+	m_DeletionQueue = deletionQueue;
+}
+
+void RenderGraph::Destroy()
+{
+	for (auto& pass : m_Passes)
+	{
+		for (auto framebuffer : pass.Framebuffers)
+		{
+			vkDestroyFramebuffer(m_VkDevice, framebuffer, nullptr);
+		}
+
+		if (pass.RenderPass != VK_NULL_HANDLE)
+		{
+			vkDestroyRenderPass(m_VkDevice, pass.RenderPass, nullptr);
+		}
+	}
+
+	for (auto& resource : m_Resources)
+	{
+		if (resource.Imported || resource.Images.empty())
+		{
+			continue;
+		}
+
+		vkDestroyImageView(m_VkDevice, resource.Views[0], nullptr);
+		m_Allocator->DestroyImage(resource.Images[0], resource.Allocation);
+	}
+
+	for (auto& slot : m_Slots)
+	{
+		m_Allocator->Free(slot.Allocation);
+	}
+
+	m_Passes.clear();
+	m_Resources.clear();
+	m_Slots.clear();
+}
+
+void RenderGraph::Reset()
+{
+	RetireImages();
+	for (auto& pass : m_Passes)
+	{
+		if (pass.RenderPass != VK_NULL_HANDLE)
+		{
+			m_DeletionQueue->Retire(pass.RenderPass);
+		}
+	}
+
+	m_Passes.clear();
+	m_Resources.clear();
+	m_Slots.clear();
+	m_After = Barriers();
+	m_ImageCount = 1;
+}
+
+uint32_t RenderGraph::ImportImage(const std::string& name, VkFormat format, VkImageLayout finalLayout, VkPipelineStageFlags waitStages)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.IsImage = true;
+	resource.Imported = true;
+	resource.Format = format;
+	resource.FinalLayout = finalLayout;
+	resource.WaitStages = waitStages;
+	m_Resources.push_back(resource);
+	return (uint32_t)m_Resources.size() - 1;
+}
+
+uint32_t RenderGraph::ImportBuffer(const std::string& name, VkBuffer buffer)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.Imported = true;
+	resource.Buffer = buffer;
+	m_Resources.push_back(resource);
+	return (uint32_t)m_Resources.size() - 1;
+}
+
+uint32_t RenderGraph::CreateImage(const std::string& name, VkFormat format, VkSampleCountFlagBits samples)
+{
+	Resource resource;
+	resource.Name = name;
+	resource.IsImage = true;
+	resource.Format = format;
+	resource.Samples = samples;
+	m_Resources.push_back(resource);
+	return (uint32_t)m_Resources.size() - 1;
+}
+
+void RenderGraph::SetImportedImages(uint32_t image, const std::vector<VkImage>& images, const std::vector<VkImageView>& views)
+{
+	auto& resource = m_Resources[image];
+	resource.Images = images;
+	resource.Views = views;
+	m_ImageCount = (uint32_t)images.size();
+}
+
+uint32_t RenderGraph::AddPass(const std::string& name, RecordFunction record)
+{
+	Pass pass;
+	pass.Name = name;
+	pass.Record = std::move(record);
+	m_Passes.push_back(std::move(pass));
+	return (uint32_t)m_Passes.size() - 1;
+}
+
+void RenderGraph::ColorAttachment(uint32_t pass, uint32_t image, bool clear)
+{
+	auto mask = clear ? VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT : VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	AddAccess(pass, { image, AccessKind::Color, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, (VkAccessFlags)mask, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, clear });
+}
+
+void RenderGraph::ResolveAttachment(uint32_t pass, uint32_t image)
+{
+	AddAccess(pass, { image, AccessKind::Resolve, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, false });
+}
+
+void RenderGraph::DepthAttachment(uint32_t pass, uint32_t image, bool clear)
+{
+	// The depth test reads even when the pass starts with a clear
+	AddAccess(pass, { image, AccessKind::Depth, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+		VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, clear });
+}
+
+void RenderGraph::ReadImage(uint32_t pass, uint32_t image, VkPipelineStageFlags stages)
+{
+	auto layout = image < m_Resources.size() && IsDepth(m_Resources[image].Format) ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	AddAccess(pass, { image, AccessKind::Image, stages, VK_ACCESS_SHADER_READ_BIT, layout, false });
+}
+
+void RenderGraph::ReadBuffer(uint32_t pass, uint32_t buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	AddAccess(pass, { buffer, AccessKind::Buffer, stages, access, VK_IMAGE_LAYOUT_UNDEFINED, false });
+}
+
+void RenderGraph::WriteBuffer(uint32_t pass, uint32_t buffer, VkPipelineStageFlags stages, VkAccessFlags access)
+{
+	AddAccess(pass, { buffer, AccessKind::Buffer, stages, access, VK_IMAGE_LAYOUT_UNDEFINED, false });
+}
+
+void RenderGraph::SetSecondary(uint32_t pass, bool secondary)
+{
+	m_Passes[pass].Secondary = secondary;
+}
+
+void RenderGraph::SetSideEffects(uint32_t pass, bool sideEffects)
+{
+	m_Passes[pass].SideEffects = sideEffects;
+}
+
+void RenderGraph::AddAccess(uint32_t pass, const Access& access)
+{
+	if (pass >= m_Passes.size() || access.Resource >= m_Resources.size())
+	{
+		throw std::runtime_error("render graph access to an unknown pass or resource!");
+	}
+
+	m_Passes[pass].Accesses.push_back(access);
+}
+
+void RenderGraph::Compile(VkExtent2D extent)
+{
+	CullPasses();
+	AssignMemory();
+	ComputeBarriers();
+
+	auto culled = std::count_if(m_Passes.begin(), m_Passes.end(), [](const Pass& pass) { return pass.Culled; });
+	auto transients = std::count_if(m_Resources.begin(), m_Resources.end(), [](const Resource& resource) { return resource.Slot != UINT32_MAX; });
+	std::cout << "Render graph: " << m_Passes.size() - culled << " passes (" << culled << " culled), " << transients << " transient images in " << m_Slots.size() << " allocations\n";
+
+	Resize(extent);
+}
+
+void RenderGraph::Resize(VkExtent2D extent)
+{
+	RetireImages();
+
+	m_Extent = extent;
+	CreateImages();
+	CreateFramebuffers();
+}
+
+void RenderGraph::Execute(VkCommandBuffer commandBuffer, uint32_t imageIndex, GpuProfiler* profiler, uint32_t slot) const
+{
+	for (uint32_t i = 0; i < m_Passes.size(); i++)
+	{
+		const auto& pass = m_Passes[i];
+		if (pass.Culled)
+		{
+			continue;
+		}
+
+		auto scope = profiler->BeginScope(commandBuffer, slot, pass.Name.c_str());
+		RecordBarriers(commandBuffer, imageIndex, pass.Before);
+
+		if (pass.RenderPass != VK_NULL_HANDLE)
+		{
+			VkRenderPassBeginInfo renderPassInfo{};
+			renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+			renderPassInfo.renderPass = pass.RenderPass;
+			renderPassInfo.framebuffer = Framebuffer(i, imageIndex);
+			renderPassInfo.renderArea.extent = m_Extent;
+			renderPassInfo.clearValueCount = (uint32_t)pass.ClearValues.size();
+			renderPassInfo.pClearValues = pass.ClearValues.data();
+
+			vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, pass.Secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+			pass.Record(commandBuffer, imageIndex);
+			vkCmdEndRenderPass(commandBuffer);
+		}
+		else
+		{
+			pass.Record(commandBuffer, imageIndex);
+		}
+
+		profiler->EndScope(commandBuffer, slot, scope);
+	}
+
+	RecordBarriers(commandBuffer, imageIndex, m_After);
+}
+
+VkFramebuffer RenderGraph::Framebuffer(uint32_t pass, uint32_t imageIndex) const
+{
+	const auto& framebuffers = m_Passes[pass].Framebuffers;
+	return framebuffers[std::min<size_t>(imageIndex, framebuffers.size() - 1)];
+}
+
+VkImageView RenderGraph::View(uint32_t image, uint32_t imageIndex) const
+{
+	const auto& resource = m_Resources[image];
+	return resource.Views[resource.Imported ? imageIndex : 0];
+}
+
+bool RenderGraph::Writes(const Access& access)
+{
+	return (access.Mask & WRITE_ACCESS) != 0;
+}
+
+bool RenderGraph::ReadsContents(const Access& access)
+{
+	switch (access.Kind)
+	{
+	case AccessKind::Color:
+	case AccessKind::Depth:
+		return !access.Clear;
+	case AccessKind::Resolve:
+		return false;
+	default:
+		return (access.Mask & ~WRITE_ACCESS) != 0;
+	}
+}
+
+bool RenderGraph::IsAttachment(const Access& access)
+{
+	return access.Kind == AccessKind::Color || access.Kind == AccessKind::Resolve || access.Kind == AccessKind::Depth;
+}
+
+void RenderGraph::CullPasses()
+{
+	// Walk backwards, a pass lives if a later pass or something outside the graph needs what it writes
+	std::vector<bool> needed(m_Resources.size());
+	for (size_t i = 0; i < m_Resources.size(); i++)
+	{
+		needed[i] = m_Resources[i].Imported;
+	}
+
+	for (size_t i = m_Passes.size(); i-- > 0;)
+	{
+		auto& pass = m_Passes[i];
+		pass.Culled = !pass.SideEffects;
+		for (const auto& access : pass.Accesses)
+		{
+			if (Writes(access) && needed[access.Resource])
+			{
+				pass.Culled = false;
+			}
+		}
+
+		if (pass.Culled)
+		{
+			continue;
+		}
+
+		for (const auto& access : pass.Accesses)
+		{
+			if (ReadsContents(access))
+			{
+				needed[access.Resource] = true;
+			}
+		}
+	}
+
+	// Lifetimes and usage only count the passes that survived
+	for (uint32_t i = 0; i < m_Passes.size(); i++)
+	{
+		if (m_Passes[i].Culled)
+		{
+			continue;
+		}
+
+		for (const auto& access : m_Passes[i].Accesses)
+		{
+			auto& resource = m_Resources[access.Resource];
+			resource.FirstPass = std::min(resource.FirstPass, i);
+			resource.LastPass = i;
+
+			switch (access.Kind)
+			{
+			case AccessKind::Color:
+			case AccessKind::Resolve:
+				resource.Usage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+				break;
+			case AccessKind::Depth:
+				resource.Usage |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+				break;
+			case AccessKind::Image:
+				resource.Usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+				break;
+			default:
+				break;
+			}
+		}
+	}
+}
+
+void RenderGraph::AssignMemory()
+{
+	// Tilers keep attachment only images in tile memory, lazily allocated memory never gets backed at all
+	auto lazyMemory = false;
+	const auto& memory = m_Allocator->MemoryProperties();
+	for (uint32_t i = 0; i < memory.memoryTypeCount; i++)
+	{
+		lazyMemory |= (memory.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT) != 0;
+	}
+
+	std::vector<uint32_t> order;
+	for (uint32_t i = 0; i < m_Resources.size(); i++)
+	{
+		const auto& resource = m_Resources[i];
+		if (resource.IsImage && !resource.Imported && resource.FirstPass != UINT32_MAX)
+		{
+			order.push_back(i);
+		}
+	}
+
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return m_Resources[a].FirstPass < m_Resources[b].FirstPass; });
+
+	// First fit in pass order, a slot is free again once the last image in it is dead
+	for (auto index : order)
+	{
+		auto& resource = m_Resources[index];
+		auto attachmentOnly = (resource.Usage & ~(VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) == 0;
+		if (attachmentOnly)
+		{
+			resource.Usage |= VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT;
+		}
+
+		auto lazy = attachmentOnly && lazyMemory;
+		for (uint32_t i = 0; i < m_Slots.size() && !lazy; i++)
+		{
+			if (!m_Slots[i].Lazy && m_Resources[m_Slots[i].Resources.back()].LastPass < resource.FirstPass)
+			{
+				resource.Slot = i;
+				break;
+			}
+		}
+
+		if (resource.Slot == UINT32_MAX)
+		{
+			MemorySlot slot;
+			slot.Lazy = lazy;
+			m_Slots.push_back(slot);
+			resource.Slot = (uint32_t)m_Slots.size() - 1;
+		}
+
+		m_Slots[resource.Slot].Resources.push_back(index);
+	}
+}
+
+void RenderGraph::ComputeBarriers()
+{
+	// The first run only finds the state every resource ends the frame in
+	std::vector<State> states(m_Resources.size());
+	for (const auto& pass : m_Passes)
+	{
+		Barriers ignored;
+		for (size_t i = 0; !pass.Culled && i < pass.Accesses.size(); i++)
+		{
+			Synchronize(states[pass.Accesses[i].Resource], pass.Accesses[i], ignored);
+		}
+	}
+
+	// Buffers carry over from the previous frame, transient images from whatever used their memory last,
+	// imported images from the semaphore wait that hands them over
+	auto ends = states;
+	for (uint32_t i = 0; i < m_Resources.size(); i++)
+	{
+		const auto& resource = m_Resources[i];
+		if (resource.Imported && resource.IsImage)
+		{
+			states[i] = State();
+			states[i].WriteStages = resource.WaitStages;
+		}
+		else if (resource.Slot != UINT32_MAX)
+		{
+			const auto& occupants = m_Slots[resource.Slot].Resources;
+			auto position = std::find(occupants.begin(), occupants.end(), i);
+			auto previous = position == occupants.begin() ? occupants.back() : *(position - 1);
+			states[i] = ends[previous];
+			states[i].Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+	}
+
+	for (uint32_t i = 0; i < m_Passes.size(); i++)
+	{
+		auto& pass = m_Passes[i];
+		pass.Before = Barriers();
+		if (pass.Culled)
+		{
+			continue;
+		}
+
+		// Attachments are transitioned and synchronized by the render pass itself
+		std::vector<VkImageLayout> initialLayouts;
+		Barriers dependency;
+		for (const auto& access : pass.Accesses)
+		{
+			auto& state = states[access.Resource];
+			if (IsAttachment(access))
+			{
+				initialLayouts.push_back(state.Layout);
+				Synchronize(state, access, dependency);
+
+				const auto& resource = m_Resources[access.Resource];
+				if (resource.Imported && resource.LastPass == i && resource.FinalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+				{
+					state.Layout = resource.FinalLayout;
+				}
+			}
+			else
+			{
+				Synchronize(state, access, pass.Before);
+			}
+		}
+
+		if (!initialLayouts.empty())
+		{
+			CreateRenderPass(i, initialLayouts, dependency);
+		}
+	}
+
+	// Imported images last used outside a render pass still need their final layout
+	m_After = Barriers();
+	for (uint32_t i = 0; i < m_Resources.size(); i++)
+	{
+		const auto& resource = m_Resources[i];
+		if (resource.Imported && resource.IsImage && resource.FinalLayout != VK_IMAGE_LAYOUT_UNDEFINED && states[i].Layout != resource.FinalLayout)
+		{
+			Synchronize(states[i], { i, AccessKind::Image, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, resource.FinalLayout, false }, m_After);
+		}
+	}
+}
+
+void RenderGraph::Synchronize(State& state, const Access& access, Barriers& barriers) const
+{
+	auto write = Writes(access);
+	auto transition = access.Kind != AccessKind::Buffer && access.Layout != state.Layout;
+
+	if (write || transition)
+	{
+		// Waits for earlier writes and reads alike, only the writes need to be made available
+		auto srcStages = state.WriteStages | state.ReadStages;
+		if (transition && !IsAttachment(access))
+		{
+			const auto& resource = m_Resources[access.Resource];
+
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.srcAccessMask = state.WriteAccess;
+			barrier.dstAccessMask = access.Mask;
+			barrier.oldLayout = state.Layout;
+			barrier.newLayout = access.Layout;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.subresourceRange.aspectMask = Aspect(resource);
+			barrier.subresourceRange.levelCount = 1;
+			barrier.subresourceRange.layerCount = 1;
+
+			barriers.Images.push_back({ access.Resource, barrier });
+			barriers.SrcStages |= srcStages;
+			barriers.DstStages |= access.Stages;
+		}
+		else if (srcStages != 0)
+		{
+			barriers.SrcStages |= srcStages;
+			barriers.DstStages |= access.Stages;
+			barriers.SrcAccess |= state.WriteAccess;
+			barriers.DstAccess |= access.Mask;
+		}
+
+		// A transition counts as a write that the accessing stages have already waited for
+		state.Layout = access.Layout;
+		state.WriteStages = access.Stages;
+		state.WriteAccess = access.Mask & WRITE_ACCESS;
+		state.ReadStages = write ? 0 : access.Stages;
+		return;
+	}
+
+	// Read after read needs nothing, read after write only for stages that have not waited on the write yet
+	if (state.WriteStages != 0 && (access.Stages & ~state.ReadStages) != 0)
+	{
+		barriers.SrcStages |= state.WriteStages;
+		barriers.DstStages |= access.Stages;
+		barriers.SrcAccess |= state.WriteAccess;
+		barriers.DstAccess |= access.Mask;
+	}
+
+	state.ReadStages |= access.Stages;
+}
+
+void RenderGraph::CreateRenderPass(uint32_t index, const std::vector<VkImageLayout>& initialLayouts, const Barriers& dependency)
+{
+	auto& pass = m_Passes[index];
+	std::vector<VkAttachmentDescription> attachments;
+	std::vector<VkAttachmentReference> colorRefs;
+	std::vector<VkAttachmentReference> resolveRefs;
+	VkAttachmentReference depthRef{ VK_ATTACHMENT_UNUSED, VK_IMAGE_LAYOUT_UNDEFINED };
+	pass.ClearValues.clear();
+
+	// Same order as the accesses, the framebuffers follow it too
+	for (const auto& access : pass.Accesses)
+	{
+		if (!IsAttachment(access))
+		{
+			continue;
+		}
+
+		const auto& resource = m_Resources[access.Resource];
+		auto initialLayout = initialLayouts[attachments.size()];
+
+		// Contents nothing reads later in the frame never leave tile memory
+		auto loadOp = access.Clear ? VK_ATTACHMENT_LOAD_OP_CLEAR : initialLayout == VK_IMAGE_LAYOUT_UNDEFINED ? VK_ATTACHMENT_LOAD_OP_DONT_CARE : VK_ATTACHMENT_LOAD_OP_LOAD;
+		auto storeOp = resource.Imported || resource.LastPass > index ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+		VkAttachmentDescription attachment{};
+		attachment.format = resource.Format;
+		attachment.samples = resource.Samples;
+		attachment.loadOp = loadOp;
+		attachment.storeOp = storeOp;
+		attachment.stencilLoadOp = HasStencil(resource.Format) ? loadOp : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+		attachment.stencilStoreOp = HasStencil(resource.Format) ? storeOp : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+		attachment.initialLayout = initialLayout;
+		attachment.finalLayout = access.Layout;
+		if (resource.Imported && resource.LastPass == index && resource.FinalLayout != VK_IMAGE_LAYOUT_UNDEFINED)
+		{
+			attachment.finalLayout = resource.FinalLayout;
+		}
+
+		VkAttachmentReference reference{ (uint32_t)attachments.size(), access.Layout };
+		VkClearValue clearValue{};
+		if (access.Kind == AccessKind::Depth)
+		{
+			depthRef = reference;
+			clearValue.depthStencil = { 1.0f, 0 };
+		}
+		else
+		{
+			(access.Kind == AccessKind::Resolve ? resolveRefs : colorRefs).push_back(reference);
+			clearValue.color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
+		}
+
+		attachments.push_back(attachment);
+		pass.ClearValues.push_back(clearValue);
+	}
+
+	// Resolves pair up with the color attachments in the order they were declared
+	if (!resolveRefs.empty() && resolveRefs.size() != colorRefs.size())
+	{
+		throw std::runtime_error("render graph pass " + pass.Name + " needs one resolve attachment per color attachment!");
+	}
+
+	VkSubpassDescription subpass{};
+	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+	subpass.colorAttachmentCount = (uint32_t)colorRefs.size();
+	subpass.pColorAttachments = colorRefs.data();
+	subpass.pResolveAttachments = resolveRefs.empty() ? nullptr : resolveRefs.data();
+	subpass.pDepthStencilAttachment = depthRef.attachment != VK_ATTACHMENT_UNUSED ? &depthRef : nullptr;
+
+	VkSubpassDependency subpassDependency{};
+	subpassDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+	subpassDependency.dstSubpass = 0;
+	subpassDependency.srcStageMask = dependency.SrcStages;
+	subpassDependency.dstStageMask = dependency.DstStages;
+	subpassDependency.srcAccessMask = dependency.SrcAccess;
+	subpassDependency.dstAccessMask = dependency.DstAccess;
+
+	VkRenderPassCreateInfo renderPassInfo{};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+	renderPassInfo.attachmentCount = (uint32_t)attachments.size();
+	renderPassInfo.pAttachments = attachments.data();
+	renderPassInfo.subpassCount = 1;
+	renderPassInfo.pSubpasses = &subpass;
+	renderPassInfo.dependencyCount = dependency.SrcStages != 0 ? 1 : 0;
+	renderPassInfo.pDependencies = &subpassDependency;
+
+	Vk::Check(vkCreateRenderPass(m_VkDevice, &renderPassInfo, nullptr, &pass.RenderPass));
+}
+
+void RenderGraph::CreateImages()
+{
+	for (auto& slot : m_Slots)
+	{
+		// The slot is as big as its biggest image and only uses memory types all of them accept
+		VkMemoryRequirements slotRequirements{ 0, 1, ~0u };
+		std::vector<uint32_t> shared;
+		for (auto index : slot.Resources)
+		{
+			auto& resource = m_Resources[index];
+
+			VkImageCreateInfo imageInfo{};
+			imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+			imageInfo.imageType = VK_IMAGE_TYPE_2D;
+			imageInfo.format = resource.Format;
+			imageInfo.extent = { m_Extent.width, m_Extent.height, 1 };
+			imageInfo.mipLevels = 1;
+			imageInfo.arrayLayers = 1;
+			imageInfo.samples = resource.Samples;
+			imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+			imageInfo.usage = resource.Usage;
+			imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+			imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+			VkImage image;
+			Vk::Check(vkCreateImage(m_VkDevice, &imageInfo, nullptr, &image));
+			resource.Images = { image };
+
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(m_VkDevice, image, &requirements);
+
+			// An image no memory type can share with the others gets its own allocation
+			if ((slotRequirements.memoryTypeBits & requirements.memoryTypeBits) == 0)
+			{
+				resource.Allocation = m_Allocator->Allocate(requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, GpuResourceKind::Optimal);
+				Vk::Check(vkBindImageMemory(m_VkDevice, image, resource.Allocation.Memory, resource.Allocation.Offset));
+				continue;
+			}
+
+			slotRequirements.size = std::max(slotRequirements.size, requirements.size);
+			slotRequirements.alignment = std::max(slotRequirements.alignment, requirements.alignment);
+			slotRequirements.memoryTypeBits &= requirements.memoryTypeBits;
+			shared.push_back(index);
+		}
+
+		VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+		if (slot.Lazy)
+		{
+			properties |= VK_MEMORY_PROPERTY_LAZILY_ALLOCATED_BIT;
+		}
+
+		slot.Allocation = m_Allocator->Allocate(slotRequirements, properties, GpuResourceKind::Optimal);
+		for (auto index : shared)
+		{
+			Vk::Check(vkBindImageMemory(m_VkDevice, m_Resources[index].Images[0], slot.Allocation.Memory, slot.Allocation.Offset));
+		}
+
+		for (auto index : slot.Resources)
+		{
+			auto& resource = m_Resources[index];
+
+			VkImageViewCreateInfo viewInfo{};
+			viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+			viewInfo.image = resource.Images[0];
+			viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+			viewInfo.format = resource.Format;
+			viewInfo.subresourceRange.aspectMask = Aspect(resource);
+			viewInfo.subresourceRange.levelCount = 1;
+			viewInfo.subresourceRange.layerCount = 1;
+
+			VkImageView view;
+			Vk::Check(vkCreateImageView(m_VkDevice, &viewInfo, nullptr, &view));
+			resource.Views = { view };
+		}
+	}
+}
+
+void RenderGraph::CreateFramebuffers()
+{
+	for (auto& pass : m_Passes)
+	{
+		if (pass.RenderPass == VK_NULL_HANDLE)
+		{
+			continue;
+		}
+
+		// One per image index, passes that only touch transient images would get away with one
+		pass.Framebuffers.resize(m_ImageCount);
+		for (uint32_t i = 0; i < m_ImageCount; i++)
+		{
+			std::vector<VkImageView> views;
+			for (const auto& access : pass.Accesses)
+			{
+				if (IsAttachment(access))
+				{
+					const auto& resource = m_Resources[access.Resource];
+					views.push_back(resource.Views[resource.Imported ? i : 0]);
+				}
+			}
+
+			VkFramebufferCreateInfo framebufferInfo{};
+			framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+			framebufferInfo.renderPass = pass.RenderPass;
+			framebufferInfo.attachmentCount = (uint32_t)views.size();
+			framebufferInfo.pAttachments = views.data();
+			framebufferInfo.width = m_Extent.width;
+			framebufferInfo.height = m_Extent.height;
+			framebufferInfo.layers = 1;
+
+			Vk::Check(vkCreateFramebuffer(m_VkDevice, &framebufferInfo, nullptr, &pass.Framebuffers[i]));
+		}
+	}
+}
+
+void RenderGraph::RecordBarriers(VkCommandBuffer commandBuffer, uint32_t imageIndex, const Barriers& barriers) const
+{
+	if (barriers.DstStages == 0)
+	{
+		return;
+	}
+
+	VkMemoryBarrier memoryBarrier{};
+	memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	memoryBarrier.srcAccessMask = barriers.SrcAccess;
+	memoryBarrier.dstAccessMask = barriers.DstAccess;
+	auto memoryBarrierCount = barriers.SrcAccess != 0 || barriers.DstAccess != 0 ? 1u : 0u;
+
+	std::vector<VkImageMemoryBarrier> imageBarriers;
+	for (const auto& image : barriers.Images)
+	{
+		imageBarriers.push_back(image.Barrier);
+		imageBarriers.back().image = Image(m_Resources[image.Resource], imageIndex);
+	}
+
+	// Nothing to wait for, only the layout transitions are left
+	auto srcStages = barriers.SrcStages != 0 ? barriers.SrcStages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, srcStages, barriers.DstStages, 0, memoryBarrierCount, &memoryBarrier, 0, nullptr,
+		(uint32_t)imageBarriers.size(), imageBarriers.data());
+}
+
+VkImageAspectFlags RenderGraph::Aspect(const Resource& resource) const
+{
+	if (!IsDepth(resource.Format))
+	{
+		return VK_IMAGE_ASPECT_COLOR_BIT;
+	}
+
+	return HasStencil(resource.Format) ? VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT;
+}
+
+VkImage RenderGraph::Image(const Resource& resource, uint32_t imageIndex) const
+{
+	return resource.Images[resource.Imported ? imageIndex : 0];
+}
+
+void RenderGraph::RetireImages()
+{
+	for (auto& pass : m_Passes)
+	{
+		for (auto framebuffer : pass.Framebuffers)
+		{
+			m_DeletionQueue->Retire(framebuffer);
+		}
+
+		pass.Framebuffers.clear();
+	}
+
+	for (auto& resource : m_Resources)
+	{
+		if (resource.Imported || resource.Images.empty())
+		{
+			continue;
+		}
+
+		m_DeletionQueue->Retire(resource.Views[0]);
+		m_DeletionQueue->Retire(resource.Images[0], resource.Allocation);
+		resource.Images.clear();
+		resource.Views.clear();
+		resource.Allocation = GpuAllocation();
+	}
+
+	for (auto& slot : m_Slots)
+	{
+		if (slot.Allocation.Block != UINT32_MAX)
+		{
+			m_DeletionQueue->Retire(slot.Allocation);
+			slot.Allocation = GpuAllocation();
+		}
+	}
+}
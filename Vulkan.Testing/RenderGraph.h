@@ -0,0 +1,188 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "GpuAllocator.h"
+#include "DeletionQueue.h"
+#include "GpuProfiler.h"
+
+// Frame graph, passes declare what they read and write and the graph derives everything in between:
+// render passes with their load and store ops, pipeline barriers and layout transitions, and memory for
+// transient images, shared between images whose lifetimes within the frame do not overlap.
+// Passes that contribute nothing to an imported resource are culled. The frame is assumed to repeat, so
+// the first access of a frame is synchronized against the last one of the previous frame.
+class RenderGraph
+{
+public:
+	typedef std::function<void(VkCommandBuffer commandBuffer, uint32_t imageIndex)> RecordFunction;
+
+	RenderGraph();
+	virtual ~RenderGraph();
+
+	void Create(VkDevice device, GpuAllocator* allocator, DeletionQueue* deletionQueue);
+	void Destroy();
+
+	// Retires every compiled object and forgets all declarations, used when the frame structure changes
+	void Reset();
+
+	// Resources. Imported images are indexed by the image index passed to Execute, waitStages is where a
+	// semaphore wait makes the image available and finalLayout what it is left in at the end of the frame
+	uint32_t ImportImage(const std::string& name, VkFormat format, VkImageLayout finalLayout, VkPipelineStageFlags waitStages);
+	uint32_t ImportBuffer(const std::string& name, VkBuffer buffer);
+	uint32_t CreateImage(const std::string& name, VkFormat format, VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT);
+	void SetImportedImages(uint32_t image, const std::vector<VkImage>& images, const std::vector<VkImageView>& views);
+
+	// Passes run in the order they were added. A pass with attachments records inside its render pass
+	uint32_t AddPass(const std::string& name, RecordFunction record);
+	void ColorAttachment(uint32_t pass, uint32_t image, bool clear);
+	void ResolveAttachment(uint32_t pass, uint32_t image);
+	void DepthAttachment(uint32_t pass, uint32_t image, bool clear);
+	// Depth images are read in the depth stencil read only layout, everything else as shader read only
+	void ReadImage(uint32_t pass, uint32_t image, VkPipelineStageFlags stages);
+	void ReadBuffer(uint32_t pass, uint32_t buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+	void WriteBuffer(uint32_t pass, uint32_t buffer, VkPipelineStageFlags stages, VkAccessFlags access);
+
+	// The pass only executes secondary command buffers inside its render pass
+	void SetSecondary(uint32_t pass, bool secondary);
+
+	// Keeps a pass whose results leave the graph some other way, e.g. through a readback
+	void SetSideEffects(uint32_t pass, bool sideEffects);
+
+	// Culls, orders the barriers and creates the render passes, then allocates for the extent
+	void Compile(VkExtent2D extent);
+
+	// Recreates the transient images and framebuffers, render passes and therefore pipelines stay valid
+	void Resize(VkExtent2D extent);
+
+	// Records every pass that survived culling, each in a profiler scope named after it
+	void Execute(VkCommandBuffer commandBuffer, uint32_t imageIndex, GpuProfiler* profiler, uint32_t slot) const;
+
+	VkRenderPass RenderPass(uint32_t pass) const { return m_Passes[pass].RenderPass; }
+	VkFramebuffer Framebuffer(uint32_t pass, uint32_t imageIndex) const;
+
+	// Changes with every Compile and Resize, descriptors pointing at a transient image have to follow it
+	VkImageView View(uint32_t image, uint32_t imageIndex = 0) const;
+	bool IsCulled(uint32_t pass) const { return m_Passes[pass].Culled; }
+
+private:
+	enum class AccessKind
+	{
+		Buffer,
+		Image,
+		Color,
+		Resolve,
+		Depth,
+	};
+
+	struct Access
+	{
+		uint32_t Resource;
+		AccessKind Kind;
+		VkPipelineStageFlags Stages;
+		VkAccessFlags Mask;
+		VkImageLayout Layout;
+		bool Clear;
+	};
+
+	struct ImageBarrier
+	{
+		uint32_t Resource;
+		VkImageMemoryBarrier Barrier;
+	};
+
+	// Everything that has to happen before a pass, or after the last one
+	struct Barriers
+	{
+		VkPipelineStageFlags SrcStages = 0;
+		VkPipelineStageFlags DstStages = 0;
+		VkAccessFlags SrcAccess = 0;
+		VkAccessFlags DstAccess = 0;
+		std::vector<ImageBarrier> Images;
+	};
+
+	struct Pass
+	{
+		std::string Name;
+		RecordFunction Record;
+		std::vector<Access> Accesses;
+		bool Secondary = false;
+		bool SideEffects = false;
+		bool Culled = false;
+
+		// Compiled
+		Barriers Before;
+		VkRenderPass RenderPass = VK_NULL_HANDLE;
+		std::vector<VkFramebuffer> Framebuffers;
+		std::vector<VkClearValue> ClearValues;
+	};
+
+	struct Resource
+	{
+		std::string Name;
+		bool IsImage = false;
+		bool Imported = false;
+		VkFormat Format = VK_FORMAT_UNDEFINED;
+		VkSampleCountFlagBits Samples = VK_SAMPLE_COUNT_1_BIT;
+		VkImageLayout FinalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags WaitStages = 0;
+		VkBuffer Buffer = VK_NULL_HANDLE;
+
+		// Imported images have one per image index, transient ones exactly one
+		std::vector<VkImage> Images;
+		std::vector<VkImageView> Views;
+
+		// Compiled
+		VkImageUsageFlags Usage = 0;
+		uint32_t FirstPass = UINT32_MAX;
+		uint32_t LastPass = 0;
+		uint32_t Slot = UINT32_MAX;
+		GpuAllocation Allocation;
+	};
+
+	// Transient images that take turns on the same memory, in pass order
+	struct MemorySlot
+	{
+		std::vector<uint32_t> Resources;
+		bool Lazy = false;
+		GpuAllocation Allocation;
+	};
+
+	// What the last accesses of a resource left behind
+	struct State
+	{
+		VkImageLayout Layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkPipelineStageFlags WriteStages = 0;
+		VkAccessFlags WriteAccess = 0;
+		VkPipelineStageFlags ReadStages = 0;
+	};
+
+	static bool Writes(const Access& access);
+	static bool ReadsContents(const Access& access);
+	static bool IsAttachment(const Access& access);
+
+	void AddAccess(uint32_t pass, const Access& access);
+	void CullPasses();
+	void AssignMemory();
+	void ComputeBarriers();
+	void Synchronize(State& state, const Access& access, Barriers& barriers) const;
+	void CreateRenderPass(uint32_t index, const std::vector<VkImageLayout>& initialLayouts, const Barriers& dependency);
+	void CreateImages();
+	void CreateFramebuffers();
+	void RecordBarriers(VkCommandBuffer commandBuffer, uint32_t imageIndex, const Barriers& barriers) const;
+	VkImageAspectFlags Aspect(const Resource& resource) const;
+	VkImage Image(const Resource& resource, uint32_t imageIndex) const;
+	void RetireImages();
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	GpuAllocator* m_Allocator = nullptr;
+	DeletionQueue* m_DeletionQueue = nullptr;
+
+	VkExtent2D m_Extent{};
+	uint32_t m_ImageCount = 1;
+	std::vector<Resource> m_Resources;
+	std::vector<Pass> m_Passes;
+	std::vector<MemorySlot> m_Slots;
+	Barriers m_After;
+};
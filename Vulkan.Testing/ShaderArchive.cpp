@@ -0,0 +1,240 @@
+#include "ShaderArchive.h"
+#include "VkUtils.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+namespace
+{
+	const uint32_t ARCHIVE_MAGIC = 0x41565053; // "SPVA"
+	const uint32_t ARCHIVE_VERSION = 1;
+	const uint32_t SPIRV_MAGIC = 0x07230203;
+
+	struct ArchiveHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t EntryCount;
+		uint32_t Reserved;
+	};
+
+	// Sorted by name hash, offsets are from the start of the file and always word aligned
+	struct ArchiveEntry
+	{
+		uint64_t NameHash;
+		uint64_t ContentHash;
+		uint64_t Offset;
+		uint64_t Size;
+	};
+
+	uint64_t NameHash(const std::string& path)
+	{
+		auto name = std::filesystem::path(path).filename().string();
+		return Vk::Hash(name.data(), name.size());
+	}
+
+	bool ReadSpirv(const std::string& path, std::vector<uint32_t>& words)
+	{
+		std::ifstream file(path, std::ios::ate | std::ios::binary);
+		if (!file.is_open())
+		{
+			return false;
+		}
+
+		// Read straight into words so the code is aligned for vkCreateShaderModule
+		auto size = (size_t)file.tellg();
+		if (size < sizeof(uint32_t) || size % sizeof(uint32_t) != 0)
+		{
+			return false;
+		}
+
+		words.resize(size / sizeof(uint32_t));
+		file.seekg(0);
+		file.read(reinterpret_cast<char*>(words.data()), size);
+		return file && words[0] == SPIRV_MAGIC;
+	}
+}
+
+ShaderArchive::ShaderArchive()
+{
+}
+
+ShaderArchive::~ShaderArchive()
+{
+}
+
+bool ShaderArchive::Open(const std::string& path)
+{
+	Close();
+
+	if (!m_File.Open(path))
+	{
+		return false;
+	}
+
+	m_Data = m_File.Data();
+	m_Size = m_File.Size();
+
+	// Reject anything that would make a lookup read outside the file
+	auto header = reinterpret_cast<const ArchiveHeader*>(m_Data);
+	if (m_Size < sizeof(ArchiveHeader) || header->Magic != ARCHIVE_MAGIC || header->Version != ARCHIVE_VERSION ||
+		(m_Size - sizeof(ArchiveHeader)) / sizeof(ArchiveEntry) < header->EntryCount)
+	{
+		std::cout << "Shader archive " << path << " is invalid, using loose shaders\n";
+		Close();
+		return false;
+	}
+
+	auto entries = reinterpret_cast<const ArchiveEntry*>(m_Data + sizeof(ArchiveHeader));
+	for (uint32_t i = 0; i < header->EntryCount; i++)
+	{
+		const auto& entry = entries[i];
+		if (entry.Offset % sizeof(uint32_t) != 0 || entry.Size % sizeof(uint32_t) != 0 || entry.Offset > m_Size || entry.Size > m_Size - entry.Offset)
+		{
+			std::cout << "Shader archive " << path << " is invalid, using loose shaders\n";
+			Close();
+			return false;
+		}
+	}
+
+	std::error_code error;
+	m_WriteTime = std::filesystem::last_write_time(path, error);
+	m_Count = header->EntryCount;
+	std::cout << "Shader archive: " << m_Count << " shaders, " << m_Size / 1024 << " KiB mapped\n";
+	return true;
+}
+
+void ShaderArchive::Close()
+{
+	m_File.Close();
+	m_Data = nullptr;
+	m_Size = 0;
+	m_Count = 0;
+}
+
+SpirvSpan ShaderArchive::Load(const std::string& path, std::vector<uint32_t>& storage) const
+{
+	SpirvSpan span;
+	std::error_code error;
+	auto looseTime = std::filesystem::last_write_time(path, error);
+	bool rebuilt = !error && looseTime > m_WriteTime;
+	if (!rebuilt && Find(path, span))
+	{
+		return span;
+	}
+
+	if (!ReadSpirv(path, storage))
+	{
+		throw std::runtime_error("failed to load shader " + path + "!");
+	}
+
+	span.Code = storage.data();
+	span.Size = storage.size() * sizeof(uint32_t);
+	span.Hash = Vk::Hash(span.Code, span.Size);
+	return span;
+}
+
+bool ShaderArchive::Find(const std::string& name, SpirvSpan& span) const
+{
+	if (m_Count == 0)
+	{
+		return false;
+	}
+
+	auto entries = reinterpret_cast<const ArchiveEntry*>(m_Data + sizeof(ArchiveHeader));
+	auto hash = NameHash(name);
+	auto entry = std::lower_bound(entries, entries + m_Count, hash, [](const ArchiveEntry& entry, uint64_t hash) { return entry.NameHash < hash; });
+	if (entry == entries + m_Count || entry->NameHash != hash)
+	{
+		return false;
+	}
+
+	span.Code = reinterpret_cast<const uint32_t*>(m_Data + entry->Offset);
+	span.Size = (size_t)entry->Size;
+	span.Hash = entry->ContentHash;
+	return true;
+}
+
+bool ShaderArchive::Pack(const std::string& output, const std::vector<std::string>& inputs)
+{
+	std::vector<ArchiveEntry> entries;
+	std::vector<uint32_t> blob;
+	std::map<uint64_t, uint64_t> offsets;
+
+	// Blobs go behind the index, so their offsets are known once the entry count is
+	auto dataOffset = sizeof(ArchiveHeader) + inputs.size() * sizeof(ArchiveEntry);
+	for (const auto& input : inputs)
+	{
+		std::vector<uint32_t> words;
+		if (!ReadSpirv(input, words))
+		{
+			std::cout << "Could not read SPIR-V from " << input << '\n';
+			return false;
+		}
+
+		ArchiveEntry entry{};
+		entry.NameHash = NameHash(input);
+		entry.ContentHash = Vk::Hash(words.data(), words.size() * sizeof(uint32_t));
+		entry.Size = words.size() * sizeof(uint32_t);
+
+		// Identical modules share their bytes
+		auto found = offsets.find(entry.ContentHash);
+		if (found != offsets.end())
+		{
+			entry.Offset = found->second;
+		}
+		else
+		{
+			entry.Offset = dataOffset + blob.size() * sizeof(uint32_t);
+			offsets[entry.ContentHash] = entry.Offset;
+			blob.insert(blob.end(), words.begin(), words.end());
+		}
+
+		entries.push_back(entry);
+	}
+
+	std::sort(entries.begin(), entries.end(), [](const ArchiveEntry& a, const ArchiveEntry& b) { return a.NameHash < b.NameHash; });
+	for (size_t i = 1; i < entries.size(); i++)
+	{
+		if (entries[i].NameHash == entries[i - 1].NameHash)
+		{
+			std::cout << "Two shaders share a file name, they would shadow each other in the archive\n";
+			return false;
+		}
+	}
+
+	ArchiveHeader header{};
+	header.Magic = ARCHIVE_MAGIC;
+	header.Version = ARCHIVE_VERSION;
+	header.EntryCount = (uint32_t)entries.size();
+
+	// Write next to the real file, then swap it in so a crash never leaves a half written archive
+	auto tempPath = output + ".tmp";
+	{
+		std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ArchiveEntry));
+		file.write(reinterpret_cast<const char*>(blob.data()), blob.size() * sizeof(uint32_t));
+		file.flush();
+
+		if (!file)
+		{
+			std::cout << "Could not write shader archive " << tempPath << '\n';
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, output, error);
+	if (error)
+	{
+		std::cout << "Could not replace shader archive " << output << ": " << error.message() << '\n';
+		std::filesystem::remove(tempPath, error);
+		return false;
+	}
+
+	std::cout << "Packed " << entries.size() << " shaders (" << offsets.size() << " unique) into " << output << '\n';
+	return true;
+}
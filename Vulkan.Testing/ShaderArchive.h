@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+#include "MappedFile.h"
+
+// SPIR-V words ready for vkCreateShaderModule, the hash identifies the content and not the file
+struct SpirvSpan
+{
+	const uint32_t* Code = nullptr;
+	size_t Size = 0;
+	uint64_t Hash = 0;
+};
+
+// Every shader of the renderer packed into one file with a sorted hash index in front.
+// The file is mapped once and lookups hand out spans straight into the mapping, identical
+// modules are stored once. Shaders missing from the archive, or rebuilt since it was packed, are read from loose files.
+class ShaderArchive
+{
+public:
+	ShaderArchive();
+	virtual ~ShaderArchive();
+
+	// A missing or invalid archive leaves it empty, every lookup then falls back to loose files
+	bool Open(const std::string& path);
+	void Close();
+
+	// Looked up by file name, zero copy from the archive, otherwise the loose file is read into storage.
+	// A loose file newer than the archive wins, so a shader build never runs against a stale pack
+	SpirvSpan Load(const std::string& path, std::vector<uint32_t>& storage) const;
+
+	// Packs loose SPIR-V files into an archive, used by --pack-shaders
+	static bool Pack(const std::string& output, const std::vector<std::string>& inputs);
+
+	constexpr uint32_t Count() const { return m_Count; }
+
+private:
+	bool Find(const std::string& name, SpirvSpan& span) const;
+
+	MappedFile m_File;
+	const uint8_t* m_Data = nullptr;
+	size_t m_Size = 0;
+	uint32_t m_Count = 0;
+	std::filesystem::file_time_type m_WriteTime;
+};
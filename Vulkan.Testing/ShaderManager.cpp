@@ -0,0 +1,202 @@
+#include "ShaderManager.h"
+#include <shaderc/shaderc.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const int WATCH_INTERVAL_MS = 250;
+
+	shaderc_shader_kind ShaderKind(const std::filesystem::path& path)
+	{
+		auto extension = path.extension().string();
+		if (extension == ".vert")
+		{
+			return shaderc_glsl_vertex_shader;
+		}
+
+		if (extension == ".frag")
+		{
+			return shaderc_glsl_fragment_shader;
+		}
+
+		if (extension == ".comp")
+		{
+			return shaderc_glsl_compute_shader;
+		}
+
+		// Let the #pragma shader_stage in the source decide
+		return shaderc_glsl_infer_from_source;
+	}
+}
+
+ShaderManager::ShaderManager()
+{
+}
+
+ShaderManager::~ShaderManager()
+{
+}
+
+void ShaderManager::Watch(const std::string& source, const std::string& spirv)
+{
+	m_Shaders.push_back({ source, spirv, {} });
+}
+
+void ShaderManager::Create(const std::string& sourceDirectory)
+{
+	m_Directory = sourceDirectory;
+
+	// Sources edited while the process was not running are compiled on the first pass
+	std::error_code error;
+	for (auto& shader : m_Shaders)
+	{
+		auto spirvTime = std::filesystem::last_write_time(shader.Spirv, error);
+		shader.LastWrite = error ? std::filesystem::file_time_type::min() : spirvTime;
+	}
+
+#if defined(__linux__)
+	// Editors often save through a temporary file and a rename, so watch the directory and not the files
+	m_Notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_Notify >= 0 && inotify_add_watch(m_Notify, m_Directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		std::cout << "Could not watch " << m_Directory << ", falling back to polling\n";
+		close(m_Notify);
+		m_Notify = -1;
+	}
+#endif
+
+	m_Running = true;
+	m_Thread = std::thread(&ShaderManager::Run, this);
+	std::cout << "Watching " << m_Shaders.size() << " shaders in " << m_Directory << '\n';
+}
+
+void ShaderManager::Destroy()
+{
+	if (!m_Running)
+	{
+		return;
+	}
+
+	m_Running = false;
+	m_Thread.join();
+
+#if defined(__linux__)
+	if (m_Notify >= 0)
+	{
+		close(m_Notify);
+		m_Notify = -1;
+	}
+#endif
+}
+
+std::vector<std::string> ShaderManager::TakeChanged()
+{
+	std::lock_guard<std::mutex> lock(m_Mutex);
+	std::vector<std::string> changed;
+	changed.swap(m_Changed);
+	return changed;
+}
+
+void ShaderManager::Run()
+{
+	while (m_Running)
+	{
+#if defined(__linux__)
+		if (m_Notify >= 0)
+		{
+			// Only used to sleep until something happened, the timestamps below decide what to rebuild
+			pollfd descriptor{ m_Notify, POLLIN, 0 };
+			if (poll(&descriptor, 1, WATCH_INTERVAL_MS) <= 0)
+			{
+				continue;
+			}
+
+			char events[4096];
+			while (read(m_Notify, events, sizeof(events)) > 0)
+			{
+			}
+		}
+		else
+#endif
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(WATCH_INTERVAL_MS));
+		}
+
+		for (auto& shader : m_Shaders)
+		{
+			std::error_code error;
+			auto sourceTime = std::filesystem::last_write_time(m_Directory / shader.Source, error);
+			if (error || sourceTime <= shader.LastWrite)
+			{
+				continue;
+			}
+
+			// Failed sources are not retried until they change again
+			shader.LastWrite = sourceTime;
+			if (Compile(shader))
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+				m_Changed.push_back(shader.Spirv);
+			}
+		}
+	}
+}
+
+bool ShaderManager::Compile(Shader& shader)
+{
+	auto path = m_Directory / shader.Source;
+	std::ifstream file(path, std::ios::binary);
+	if (!file.is_open())
+	{
+		std::cout << "Could not open shader " << path << '\n';
+		return false;
+	}
+
+	std::stringstream source;
+	source << file.rdbuf();
+
+	shaderc::Compiler compiler;
+	shaderc::CompileOptions options;
+	options.SetTargetEnvironment(shaderc_target_env_vulkan, shaderc_env_version_vulkan_1_2);
+	options.SetOptimizationLevel(shaderc_optimization_level_performance);
+
+	auto result = compiler.CompileGlslToSpv(source.str(), ShaderKind(path), shader.Source.c_str(), options);
+	if (result.GetCompilationStatus() != shaderc_compilation_status_success)
+	{
+		std::cout << result.GetErrorMessage();
+		return false;
+	}
+
+	// Write next to the real file, then swap it in so a pipeline build never reads half a module
+	std::vector<uint32_t> spirv(result.cbegin(), result.cend());
+	auto tempPath = shader.Spirv + ".tmp";
+	{
+		std::ofstream output(tempPath, std::ios::binary | std::ios::trunc);
+		output.write(reinterpret_cast<const char*>(spirv.data()), spirv.size() * sizeof(uint32_t));
+		if (!output)
+		{
+			std::cout << "Could not write " << tempPath << '\n';
+			return false;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(tempPath, shader.Spirv, error);
+	if (error)
+	{
+		std::cout << "Could not replace " << shader.Spirv << ": " << error.message() << '\n';
+		return false;
+	}
+
+	std::cout << "Recompiled " << shader.Source << '\n';
+	return true;
+}
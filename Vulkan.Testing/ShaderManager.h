@@ -0,0 +1,47 @@
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Watches GLSL sources and recompiles them to SPIR-V in process on a background thread.
+// Changes are picked up with inotify on Linux and by polling modification times elsewhere.
+// A source that fails to compile keeps its previous SPIR-V, the errors go to the console.
+class ShaderManager
+{
+public:
+	ShaderManager();
+	virtual ~ShaderManager();
+
+	// Starts watching the source directory, register the shaders before calling this
+	void Watch(const std::string& source, const std::string& spirv);
+	void Create(const std::string& sourceDirectory);
+	void Destroy();
+
+	// SPIR-V paths rewritten since the last call
+	std::vector<std::string> TakeChanged();
+
+private:
+	struct Shader
+	{
+		std::string Source;
+		std::string Spirv;
+		std::filesystem::file_time_type LastWrite;
+	};
+
+	void Run();
+	bool Compile(Shader& shader);
+
+	std::filesystem::path m_Directory;
+	std::vector<Shader> m_Shaders;
+
+	std::thread m_Thread;
+	std::atomic<bool> m_Running = false;
+	int m_Notify = -1;
+
+	std::mutex m_Mutex;
+	std::vector<std::string> m_Changed;
+};
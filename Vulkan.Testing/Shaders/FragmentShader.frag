@@ -1,10 +1,22 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUV;
 
 layout(location = 0) out vec4 outColor;
 
+// Every texture of the bindless heap, streamed ones and the white placeholder
+layout(set = 0, binding = 1) uniform sampler2D textures[];
+
+layout(push_constant) uniform DrawConstants {
+    uint instanceBuffer;
+    float spin;
+    uint texture;
+} draw;
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    // Indirect draws of different objects can end up in one subgroup, so the index is not uniform
+    outColor = vec4(fragColor, 1.0) * texture(textures[nonuniformEXT(draw.texture)], fragUV);
 }
\ No newline at end of file
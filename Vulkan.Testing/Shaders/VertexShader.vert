@@ -1,21 +1,44 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
 
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUV;
+
+struct Instance {
+    vec4 offsetScale;
+    vec4 color;
+};
+
+// Every storage buffer of the bindless heap, the push constants pick the one to read
+layout(std430, set = 0, binding = 0) readonly buffer Instances {
+    Instance instances[];
+} instanceBuffers[];
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-    );
+// Written once per frame, bound with a dynamic offset into the uniform ring
+layout(std140, set = 1, binding = 0) uniform FrameUniforms {
+    mat4 transform;
+    vec4 time;
+} frame;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-    );
+layout(push_constant) uniform DrawConstants {
+    uint instanceBuffer;
+    float spin;
+    uint texture;
+} draw;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
+    Instance instance = instanceBuffers[draw.instanceBuffer].instances[gl_InstanceIndex];
+
+    // Every object spins around its own center, animated on the GPU from the frame time alone
+    float angle = frame.time.x * draw.spin;
+    vec2 position = mat2(cos(angle), sin(angle), -sin(angle), cos(angle)) * inPosition.xy;
+    gl_Position = frame.transform * vec4(position * instance.offsetScale.z + instance.offsetScale.xy, inPosition.z, 1.0);
+    fragColor = inColor * instance.color.rgb;
+
+    // Object space, so the texture turns with the object
+    fragUV = inPosition.xy * 0.5 + 0.5;
 }
\ No newline at end of file
@@ -1,3 +1,6 @@
-E:/1.2.162.0/VulkanSDK/Bin32/glslc.exe VertexShader.vert -o vert.spv
-E:/1.2.162.0/VulkanSDK/Bin32/glslc.exe FragmentShader.frag -o frag.spv
+"%VULKAN_SDK%\Bin\glslc.exe" VertexShader.vert -o vert.spv
+"%VULKAN_SDK%\Bin\glslc.exe" FragmentShader.frag -o frag.spv
+"%VULKAN_SDK%\Bin\glslc.exe" Culling.comp -o cull.spv
+"%VULKAN_SDK%\Bin\glslc.exe" DepthPyramid.comp -o pyramid.spv
+"%VULKAN_SDK%\Bin\glslc.exe" DepthPyramid.comp -DMULTISAMPLED -o pyramid_ms.spv
 pause
\ No newline at end of file
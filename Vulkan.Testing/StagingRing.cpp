@@ -0,0 +1,444 @@
+#include "StagingRing.h"
+#include "VkUtils.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+	// Keeps every copy source aligned for buffer to image copies of any block size
+	const VkDeviceSize STAGING_ALIGNMENT = 16;
+}
+
+StagingRing::StagingRing()
+{
+}
+
+StagingRing::~StagingRing()
+{
+}
+
+void StagingRing::Create(VkDevice device, GpuAllocator* allocator, uint32_t queueFamily, VkQueue queue, uint32_t destinationFamily, VkQueue destinationQueue,
+	VkDeviceSize size)
+{
+	m_VkDevice = device;
+	m_Allocator = allocator;
+	m_Queue = queue;
+	m_QueueFamily = queueFamily;
+	m_DestinationQueue = destinationQueue;
+	m_DestinationFamily = destinationFamily;
+	m_Size = size;
+
+	// Persistently mapped source buffer
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = m_Size;
+	bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	m_Buffer = m_Allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_Allocation);
+
+	// Upload command buffers are short lived and reset one by one
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamily;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	Vk::Check(vkCreateCommandPool(m_VkDevice, &poolInfo, nullptr, &m_CommandPool));
+	m_Timeline.Create(m_VkDevice);
+
+	// The destination queue takes ownership of the uploads in its own command buffers
+	if (queueFamily != destinationFamily)
+	{
+		poolInfo.queueFamilyIndex = destinationFamily;
+		Vk::Check(vkCreateCommandPool(m_VkDevice, &poolInfo, nullptr, &m_AcquirePool));
+		m_CopyTimeline.Create(m_VkDevice);
+	}
+}
+
+void StagingRing::Destroy()
+{
+	if (m_CommandPool == VK_NULL_HANDLE)
+	{
+		return;
+	}
+
+	WaitIdle();
+
+	m_FreeBatches.clear();
+	if (IsDedicated())
+	{
+		m_CopyTimeline.Destroy();
+	}
+	m_Timeline.Destroy();
+	vkDestroyCommandPool(m_VkDevice, m_CommandPool, nullptr);
+	vkDestroyCommandPool(m_VkDevice, m_AcquirePool, nullptr);
+	m_CommandPool = VK_NULL_HANDLE;
+	m_AcquirePool = VK_NULL_HANDLE;
+
+	m_Allocator->DestroyBuffer(m_Buffer, m_Allocation);
+}
+
+void StagingRing::Upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+	// A quarter of the ring per chunk keeps earlier chunks copying while later ones are written
+	auto maxChunk = m_Size / 4;
+	auto bytes = static_cast<const char*>(data);
+
+	while (size > 0)
+	{
+		auto chunk = std::min(size, maxChunk);
+		auto position = Allocate(chunk);
+		auto offset = position % m_Size;
+
+		std::memcpy(static_cast<char*>(m_Allocation.Mapped) + offset, bytes, (size_t)chunk);
+
+		BeginBatch();
+
+		VkBufferCopy region{};
+		region.srcOffset = offset;
+		region.dstOffset = dstOffset;
+		region.size = chunk;
+		vkCmdCopyBuffer(m_Current.CommandBuffer, m_Buffer, dst, 1, &region);
+
+		if (IsDedicated())
+		{
+			VkBufferMemoryBarrier transfer{};
+			transfer.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+			transfer.srcQueueFamilyIndex = m_QueueFamily;
+			transfer.dstQueueFamilyIndex = m_DestinationFamily;
+			transfer.buffer = dst;
+			transfer.offset = dstOffset;
+			transfer.size = chunk;
+			m_Current.Transfers.push_back(transfer);
+		}
+
+		m_Current.End = m_Head;
+		bytes += chunk;
+		dstOffset += chunk;
+		size -= chunk;
+	}
+}
+
+void StagingRing::UploadImage(VkImage dst, uint32_t mipLevel, VkExtent2D extent, VkExtent2D blockExtent, uint32_t blockSize, const void* data)
+{
+	auto blocksX = (extent.width + blockExtent.width - 1) / blockExtent.width;
+	auto blocksY = (extent.height + blockExtent.height - 1) / blockExtent.height;
+	auto rowSize = (VkDeviceSize)blocksX * blockSize;
+	auto rowsPerChunk = (uint32_t)std::max<VkDeviceSize>(1, m_Size / 4 / rowSize);
+	auto bytes = static_cast<const char*>(data);
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = dst;
+	barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, mipLevel, 1, 0, 1 };
+
+	for (uint32_t row = 0; row < blocksY; row += rowsPerChunk)
+	{
+		auto rows = std::min(rowsPerChunk, blocksY - row);
+		auto chunk = rows * rowSize;
+		auto position = Allocate(chunk);
+		auto offset = position % m_Size;
+
+		std::memcpy(static_cast<char*>(m_Allocation.Mapped) + offset, bytes, (size_t)chunk);
+
+		// The batch may have been flushed by Allocate, so every batch the level spans starts with the transition
+		auto first = !m_Recording || row == 0;
+		BeginBatch();
+		if (first)
+		{
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.oldLayout = row == 0 ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			vkCmdPipelineBarrier(m_Current.CommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+
+		VkBufferImageCopy region{};
+		region.bufferOffset = offset;
+		region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mipLevel, 0, 1 };
+		region.imageOffset = { 0, (int32_t)(row * blockExtent.height), 0 };
+		region.imageExtent = { extent.width, std::min(rows * blockExtent.height, extent.height - row * blockExtent.height), 1 };
+		vkCmdCopyBufferToImage(m_Current.CommandBuffer, m_Buffer, dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+		m_Current.End = m_Head;
+		bytes += chunk;
+	}
+
+	// Flush transitions the level for sampling, together with the ownership transfer on a dedicated queue
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	if (IsDedicated())
+	{
+		barrier.srcQueueFamilyIndex = m_QueueFamily;
+		barrier.dstQueueFamilyIndex = m_DestinationFamily;
+	}
+
+	m_Current.ImageTransfers.push_back(barrier);
+}
+
+VkCommandBuffer StagingRing::CommandBuffer()
+{
+	BeginBatch();
+	return IsDedicated() ? m_Current.AcquireCommandBuffer : m_Current.CommandBuffer;
+}
+
+uint64_t StagingRing::Allocate(VkDeviceSize size)
+{
+	auto alignedSize = (size + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+
+	while (true)
+	{
+		// Skip the tail end of the buffer when the allocation would straddle the wrap
+		auto position = m_Head;
+		auto offset = position % m_Size;
+		if (offset + alignedSize > m_Size)
+		{
+			position += m_Size - offset;
+		}
+
+		if (position + alignedSize - m_Tail <= m_Size)
+		{
+			m_Head = position + alignedSize;
+			return position;
+		}
+
+		// Out of space, hand the recorded copies to the GPU and wait for the oldest batch
+		if (m_Recording)
+		{
+			m_Current.End = m_Head;
+			Flush();
+		}
+
+		Update();
+		if (position + alignedSize - m_Tail <= m_Size)
+		{
+			continue;
+		}
+
+		if (m_InFlight.empty())
+		{
+			throw std::runtime_error("staging ring allocation larger than the ring!");
+		}
+
+		auto& oldest = m_InFlight.front();
+		m_Timeline.Wait(oldest.Value);
+		Update();
+	}
+}
+
+void StagingRing::BeginBatch()
+{
+	if (m_Recording)
+	{
+		return;
+	}
+
+	if (!m_FreeBatches.empty())
+	{
+		m_Current = m_FreeBatches.back();
+		m_FreeBatches.pop_back();
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = m_CommandPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		Vk::Check(vkAllocateCommandBuffers(m_VkDevice, &allocInfo, &m_Current.CommandBuffer));
+
+		if (IsDedicated())
+		{
+			allocInfo.commandPool = m_AcquirePool;
+			Vk::Check(vkAllocateCommandBuffers(m_VkDevice, &allocInfo, &m_Current.AcquireCommandBuffer));
+		}
+	}
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	Vk::Check(vkBeginCommandBuffer(m_Current.CommandBuffer, &beginInfo));
+	if (IsDedicated())
+	{
+		Vk::Check(vkBeginCommandBuffer(m_Current.AcquireCommandBuffer, &beginInfo));
+	}
+
+	m_Recording = true;
+}
+
+void StagingRing::Flush()
+{
+	if (!m_Recording)
+	{
+		return;
+	}
+
+	// Later submissions on the destination queue read the copied data as vertices, indices or shader resources
+	const VkPipelineStageFlags dstStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+		VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+	const VkAccessFlags dstAccess = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+		VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	VkMemoryBarrier barrier{};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = dstAccess;
+
+	auto& imageTransfers = m_Current.ImageTransfers;
+	if (!IsDedicated())
+	{
+		for (auto& transfer : imageTransfers)
+		{
+			transfer.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			transfer.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+
+		vkCmdPipelineBarrier(m_Current.CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages, 0, 1, &barrier, 0, nullptr,
+			(uint32_t)imageTransfers.size(), imageTransfers.data());
+		Vk::Check(vkEndCommandBuffer(m_Current.CommandBuffer));
+
+		m_Current.Value = m_Timeline.Next();
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &m_Current.Value;
+
+		auto semaphore = m_Timeline.Semaphore();
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &m_Current.CommandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &semaphore;
+
+		Vk::Check(vkQueueSubmit(m_Queue, 1, &submitInfo, VK_NULL_HANDLE));
+	}
+	else
+	{
+		// Release on the transfer queue, the matching acquire below makes the data visible
+		auto& transfers = m_Current.Transfers;
+		for (auto& transfer : transfers)
+		{
+			transfer.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			transfer.dstAccessMask = 0;
+		}
+
+		for (auto& transfer : imageTransfers)
+		{
+			transfer.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			transfer.dstAccessMask = 0;
+		}
+
+		vkCmdPipelineBarrier(m_Current.CommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+			0, 0, nullptr, (uint32_t)transfers.size(), transfers.data(), (uint32_t)imageTransfers.size(), imageTransfers.data());
+		Vk::Check(vkEndCommandBuffer(m_Current.CommandBuffer));
+
+		auto copiedValue = m_CopyTimeline.Next();
+
+		VkTimelineSemaphoreSubmitInfo timelineInfo{};
+		timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timelineInfo.signalSemaphoreValueCount = 1;
+		timelineInfo.pSignalSemaphoreValues = &copiedValue;
+
+		auto copySemaphore = m_CopyTimeline.Semaphore();
+		VkSubmitInfo submitInfo{};
+		submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submitInfo.pNext = &timelineInfo;
+		submitInfo.commandBufferCount = 1;
+		submitInfo.pCommandBuffers = &m_Current.CommandBuffer;
+		submitInfo.signalSemaphoreCount = 1;
+		submitInfo.pSignalSemaphores = &copySemaphore;
+
+		Vk::Check(vkQueueSubmit(m_Queue, 1, &submitInfo, VK_NULL_HANDLE));
+
+		// Acquire, together with the writes recorded directly on the destination queue
+		for (auto& transfer : transfers)
+		{
+			transfer.srcAccessMask = 0;
+			transfer.dstAccessMask = dstAccess;
+		}
+
+		for (auto& transfer : imageTransfers)
+		{
+			transfer.srcAccessMask = 0;
+			transfer.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		}
+
+		vkCmdPipelineBarrier(m_Current.AcquireCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dstStages,
+			0, 1, &barrier, (uint32_t)transfers.size(), transfers.data(), (uint32_t)imageTransfers.size(), imageTransfers.data());
+		Vk::Check(vkEndCommandBuffer(m_Current.AcquireCommandBuffer));
+
+		// Graphics work submitted earlier keeps running, only what comes after the acquire waits for the copies.
+		// The acquire finishing implies the copies did, so its value alone decides when the batch can be reused
+		m_Current.Value = m_Timeline.Next();
+
+		VkTimelineSemaphoreSubmitInfo acquireTimelineInfo{};
+		acquireTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		acquireTimelineInfo.waitSemaphoreValueCount = 1;
+		acquireTimelineInfo.pWaitSemaphoreValues = &copiedValue;
+		acquireTimelineInfo.signalSemaphoreValueCount = 1;
+		acquireTimelineInfo.pSignalSemaphoreValues = &m_Current.Value;
+
+		VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+		VkSubmitInfo acquireInfo{};
+		acquireInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		acquireInfo.pNext = &acquireTimelineInfo;
+		auto semaphore = m_Timeline.Semaphore();
+		acquireInfo.waitSemaphoreCount = 1;
+		acquireInfo.pWaitSemaphores = &copySemaphore;
+		acquireInfo.pWaitDstStageMask = &waitStage;
+		acquireInfo.commandBufferCount = 1;
+		acquireInfo.pCommandBuffers = &m_Current.AcquireCommandBuffer;
+		acquireInfo.signalSemaphoreCount = 1;
+		acquireInfo.pSignalSemaphores = &semaphore;
+
+		Vk::Check(vkQueueSubmit(m_DestinationQueue, 1, &acquireInfo, VK_NULL_HANDLE));
+	}
+
+	m_InFlight.push_back(m_Current);
+	m_Current = Batch();
+	m_Recording = false;
+}
+
+void StagingRing::Update()
+{
+	while (!m_InFlight.empty() && m_Timeline.IsComplete(m_InFlight.front().Value))
+	{
+		Retire(m_InFlight.front());
+		m_InFlight.pop_front();
+	}
+}
+
+void StagingRing::WaitIdle()
+{
+	Flush();
+
+	while (!m_InFlight.empty())
+	{
+		m_Timeline.Wait(m_InFlight.front().Value);
+		Retire(m_InFlight.front());
+		m_InFlight.pop_front();
+	}
+}
+
+void StagingRing::Retire(Batch& batch)
+{
+	m_Tail = std::max(m_Tail, batch.End);
+
+	Vk::Check(vkResetCommandBuffer(batch.CommandBuffer, 0));
+	if (batch.AcquireCommandBuffer != VK_NULL_HANDLE)
+	{
+		Vk::Check(vkResetCommandBuffer(batch.AcquireCommandBuffer, 0));
+	}
+
+	batch.Transfers.clear();
+	batch.ImageTransfers.clear();
+	m_FreeBatches.push_back(batch);
+}
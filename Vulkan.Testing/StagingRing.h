@@ -0,0 +1,97 @@
+#pragma once
+
+#include <deque>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "GpuAllocator.h"
+#include "GpuTimeline.h"
+
+class StagingRing
+{
+public:
+	static const VkDeviceSize DEFAULT_SIZE = 32ull * 1024 * 1024;
+
+	StagingRing();
+	virtual ~StagingRing();
+
+	// Copies run on queue. When its family differs from the destination family, ownership of every uploaded range is
+	// released there and acquired on destinationQueue, which waits on a semaphore instead of the copies stalling graphics work
+	void Create(VkDevice device, GpuAllocator* allocator, uint32_t queueFamily, VkQueue queue, uint32_t destinationFamily, VkQueue destinationQueue,
+		VkDeviceSize size = DEFAULT_SIZE);
+	void Destroy();
+
+	// Copies the data into the mapped ring and queues a vkCmdCopyBuffer into dst. Large uploads are
+	// streamed through the ring in chunks, only waiting on the GPU when the whole ring is in flight.
+	void Upload(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+
+	// Copies tightly packed texel blocks into one mip level of dst, whose previous contents are discarded. Rows of blocks
+	// are split into chunks like buffer uploads, the level ends up in SHADER_READ_ONLY_OPTIMAL on the destination queue
+	void UploadImage(VkImage dst, uint32_t mipLevel, VkExtent2D extent, VkExtent2D blockExtent, uint32_t blockSize, const void* data);
+
+	// Commands that run on the destination queue with this batch, such as image clears and layout transitions.
+	// They may run before the batch's copies land, so they must not read uploaded data
+	VkCommandBuffer CommandBuffer();
+
+	// Submits every queued copy as one batch, the batch ends with a barrier that makes the data visible to later work on the queue
+	void Flush();
+
+	// Reclaims ring space of finished batches, never waits
+	void Update();
+	void WaitIdle();
+
+	constexpr VkDeviceSize Size() const { return m_Size; }
+	constexpr bool IsDedicated() const { return m_AcquirePool != VK_NULL_HANDLE; }
+
+private:
+	struct Batch
+	{
+		VkCommandBuffer CommandBuffer = VK_NULL_HANDLE;
+
+		// Dedicated queue only, recorded for the destination queue and waiting on the copies
+		VkCommandBuffer AcquireCommandBuffer = VK_NULL_HANDLE;
+		std::vector<VkBufferMemoryBarrier> Transfers;
+
+		// Uploaded image levels, transitioned for sampling and on a dedicated queue also handed over
+		std::vector<VkImageMemoryBarrier> ImageTransfers;
+
+		// Timeline value of the batch's last submission
+		uint64_t Value = 0;
+
+		// Ring position after the last byte this batch uses
+		uint64_t End = 0;
+	};
+
+	uint64_t Allocate(VkDeviceSize size);
+	void BeginBatch();
+	void Retire(Batch& batch);
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	GpuAllocator* m_Allocator = nullptr;
+	VkQueue m_Queue = VK_NULL_HANDLE;
+	VkCommandPool m_CommandPool = VK_NULL_HANDLE;
+	uint32_t m_QueueFamily = 0;
+
+	VkQueue m_DestinationQueue = VK_NULL_HANDLE;
+	VkCommandPool m_AcquirePool = VK_NULL_HANDLE;
+	uint32_t m_DestinationFamily = 0;
+
+	// Signalled by the last submission of every batch, the copies or on a dedicated queue the acquire. Each queue
+	// signals its own timeline, so the values of either one only ever grow in submission order
+	GpuTimeline m_Timeline;
+
+	// Dedicated queue only, signalled by the copies and waited on by the acquire
+	GpuTimeline m_CopyTimeline;
+
+	VkBuffer m_Buffer = VK_NULL_HANDLE;
+	GpuAllocation m_Allocation;
+	VkDeviceSize m_Size = 0;
+
+	// Monotonic positions, the physical offset is position % size
+	uint64_t m_Head = 0;
+	uint64_t m_Tail = 0;
+
+	bool m_Recording = false;
+	Batch m_Current;
+	std::deque<Batch> m_InFlight;
+	std::vector<Batch> m_FreeBatches;
+};
@@ -0,0 +1,502 @@
+#include "TextureStreamer.h"
+#include "VkUtils.h"
+#include <algorithm>
+#include <iostream>
+
+namespace
+{
+	// Reading one byte per page is enough to fault the whole page in
+	const size_t FAULT_STRIDE = 4096;
+}
+
+TextureStreamer::TextureStreamer()
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+}
+
+void TextureStreamer::Create(VkPhysicalDevice physicalDevice, VkDevice device, GpuAllocator* allocator, StagingRing* stagingRing, BindlessHeap* bindless,
+	DeletionQueue* deletionQueue, VkDeviceSize budget, uint32_t threadCount)
+{
+	m_VkPhysicalDevice = physicalDevice;
+	m_VkDevice = device;
+	m_Allocator = allocator;
+	m_StagingRing = stagingRing;
+	m_Bindless = bindless;
+	m_DeletionQueue = deletionQueue;
+	m_Budget = budget;
+
+	// Trilinear, LOD clamping comes from the views so the sampler never changes
+	VkSamplerCreateInfo samplerInfo{};
+	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+	samplerInfo.magFilter = VK_FILTER_LINEAR;
+	samplerInfo.minFilter = VK_FILTER_LINEAR;
+	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+	samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+	Vk::Check(vkCreateSampler(m_VkDevice, &samplerInfo, nullptr, &m_Sampler));
+	CreatePlaceholder();
+
+	threadCount = std::max(1u, threadCount);
+	m_Stop = false;
+	for (uint32_t i = 0; i < threadCount; i++)
+	{
+		m_Threads.emplace_back(&TextureStreamer::Run, this);
+	}
+
+	std::cout << "Texture streaming: " << m_Budget / (1024 * 1024) << " MiB budget, " << threadCount << " workers\n";
+}
+
+void TextureStreamer::Destroy()
+{
+	// Queued files are dropped, only the ones being decoded finish
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stop = true;
+		m_Requests.clear();
+	}
+
+	m_Wake.notify_all();
+	for (auto& thread : m_Threads)
+	{
+		thread.join();
+	}
+
+	m_Threads.clear();
+
+	// The device is idle, nothing has to go through the deletion queue any more
+	for (auto& texture : m_Textures)
+	{
+		DestroyResidency(texture.Current);
+		DestroyResidency(texture.Pending);
+		texture.File.Close();
+	}
+
+	for (auto& residency : m_Retired)
+	{
+		DestroyResidency(residency);
+	}
+
+	m_Textures.clear();
+	m_Retired.clear();
+	m_Decoded.clear();
+
+	DestroyResidency(m_Placeholder);
+	vkDestroySampler(m_VkDevice, m_Sampler, nullptr);
+	m_Sampler = VK_NULL_HANDLE;
+}
+
+uint32_t TextureStreamer::Load(const std::string& path)
+{
+	auto index = (uint32_t)m_Textures.size();
+	m_Textures.emplace_back();
+
+	auto& texture = m_Textures.back();
+	texture.Path = path;
+
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Requests.push_back(&texture);
+	}
+
+	m_Wake.notify_one();
+	return index;
+}
+
+void TextureStreamer::Touch(uint32_t texture)
+{
+	if (texture != NONE)
+	{
+		m_Textures[texture].LastUsed = m_Frame;
+	}
+}
+
+uint32_t TextureStreamer::BindlessIndex(uint32_t texture) const
+{
+	if (texture == NONE || m_Textures[texture].Slot == UINT32_MAX)
+	{
+		return m_PlaceholderSlot;
+	}
+
+	return m_Textures[texture].Slot;
+}
+
+void TextureStreamer::Update()
+{
+	// Last frame's copies into these were submitted ahead of the frame that followed them
+	for (auto& residency : m_Retired)
+	{
+		m_DeletionQueue->Retire(residency.View);
+		m_DeletionQueue->Retire(residency.Image, residency.Allocation);
+	}
+
+	m_Retired.clear();
+
+	std::vector<Decoded> decoded;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		decoded.swap(m_Decoded);
+	}
+
+	// Every texture starts out with its mip tail, which is never subject to the budget
+	for (auto& result : decoded)
+	{
+		auto texture = result.Target;
+		if (!result.Succeeded)
+		{
+			std::cout << "Texture " << texture->Path << ": " << result.Error << '\n';
+			texture->Status = State::Failed;
+			texture->File.Close();
+			continue;
+		}
+
+		texture->Status = State::Resident;
+		texture->Pending = CreateResidency(*texture, texture->TailLevel);
+	}
+
+	// Textures used this frame ask for their full chain once the tail is in place
+	for (auto& texture : m_Textures)
+	{
+		auto& current = texture.Current;
+		if (texture.Status != State::Resident || texture.LastUsed != m_Frame || texture.Pending.Image != VK_NULL_HANDLE ||
+			current.Image == VK_NULL_HANDLE || current.FirstLevel == 0 || current.LoadedLevel != current.FirstLevel)
+		{
+			continue;
+		}
+
+		if (MakeRoom(ChainSize(texture, 0)))
+		{
+			texture.Pending = CreateResidency(texture, 0);
+		}
+	}
+
+	// Smallest level of any texture first, so everything is visible at some detail before anything gets sharp
+	VkDeviceSize uploaded = 0;
+	while (true)
+	{
+		Texture* next = nullptr;
+		Residency* target = nullptr;
+		size_t nextSize = SIZE_MAX;
+		for (auto& texture : m_Textures)
+		{
+			auto residency = texture.Status == State::Resident ? UploadTarget(texture) : nullptr;
+			if (residency == nullptr)
+			{
+				continue;
+			}
+
+			auto level = residency->LoadedLevel == UINT32_MAX ? (uint32_t)texture.Data.Levels.size() - 1 : residency->LoadedLevel - 1;
+			if (texture.Data.Levels[level].Size < nextSize)
+			{
+				next = &texture;
+				target = residency;
+				nextSize = texture.Data.Levels[level].Size;
+			}
+		}
+
+		if (next == nullptr || (uploaded > 0 && uploaded + nextSize > UPLOAD_PER_FRAME))
+		{
+			break;
+		}
+
+		uploaded += UploadLevel(*next, *target);
+		Publish(*next);
+	}
+
+	m_Frame++;
+}
+
+void TextureStreamer::Run()
+{
+	while (true)
+	{
+		Texture* texture = nullptr;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_Wake.wait(lock, [this] { return m_Stop || !m_Requests.empty(); });
+			if (m_Stop)
+			{
+				return;
+			}
+
+			texture = m_Requests.front();
+			m_Requests.pop_front();
+		}
+
+		// A broken file leaves its texture on the placeholder instead of taking the renderer down
+		Decoded result;
+		result.Target = texture;
+		try
+		{
+			result.Succeeded = Decode(*texture, result.Error);
+		}
+		catch (const std::exception& e)
+		{
+			result.Error = e.what();
+		}
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Decoded.push_back(std::move(result));
+	}
+}
+
+bool TextureStreamer::Decode(Texture& texture, std::string& error)
+{
+	if (!texture.File.Open(texture.Path))
+	{
+		error = "could not be opened";
+		return false;
+	}
+
+	if (!Ktx2::Parse(texture.File.Data(), texture.File.Size(), texture.Data, error))
+	{
+		return false;
+	}
+
+	// BCn formats are only reported when the device supports them
+	VkFormatProperties properties;
+	vkGetPhysicalDeviceFormatProperties(m_VkPhysicalDevice, texture.Data.Format, &properties);
+	if (!(properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT))
+	{
+		error = "format " + std::to_string(texture.Data.Format) + " can not be sampled on this device";
+		return false;
+	}
+
+	const auto& levels = texture.Data.Levels;
+	texture.TailLevel = (uint32_t)levels.size() - 1;
+	for (uint32_t i = 0; i < levels.size(); i++)
+	{
+		if (levels[i].Width <= TAIL_SIZE && levels[i].Height <= TAIL_SIZE)
+		{
+			texture.TailLevel = i;
+			break;
+		}
+	}
+
+	// Fault the levels in in upload order, the copies into the staging ring then never wait on the disk
+	volatile uint8_t sink = 0;
+	for (auto level = levels.rbegin(); level != levels.rend(); ++level)
+	{
+		for (size_t offset = 0; offset < level->Size; offset += FAULT_STRIDE)
+		{
+			sink = sink ^ level->Data[offset];
+		}
+	}
+
+	return true;
+}
+
+void TextureStreamer::CreatePlaceholder()
+{
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+	imageInfo.extent = { 1, 1, 1 };
+	imageInfo.mipLevels = 1;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	m_Placeholder.Image = m_Allocator->CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_Placeholder.Allocation);
+
+	const uint32_t white = 0xFFFFFFFF;
+	m_StagingRing->UploadImage(m_Placeholder.Image, 0, { 1, 1 }, { 1, 1 }, sizeof(white), &white);
+
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = m_Placeholder.Image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = imageInfo.format;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+	Vk::Check(vkCreateImageView(m_VkDevice, &viewInfo, nullptr, &m_Placeholder.View));
+	m_PlaceholderSlot = m_Bindless->AddTexture(m_Placeholder.View, m_Sampler);
+}
+
+TextureStreamer::Residency TextureStreamer::CreateResidency(const Texture& texture, uint32_t firstLevel)
+{
+	const auto& first = texture.Data.Levels[firstLevel];
+
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType = VK_IMAGE_TYPE_2D;
+	imageInfo.format = texture.Data.Format;
+	imageInfo.extent = { first.Width, first.Height, 1 };
+	imageInfo.mipLevels = (uint32_t)texture.Data.Levels.size() - firstLevel;
+	imageInfo.arrayLayers = 1;
+	imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+	imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+	imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+	Residency residency;
+	residency.Image = m_Allocator->CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, residency.Allocation);
+	residency.FirstLevel = firstLevel;
+	m_ResidentBytes += residency.Allocation.Size;
+	return residency;
+}
+
+void TextureStreamer::DestroyResidency(Residency& residency)
+{
+	if (residency.View != VK_NULL_HANDLE)
+	{
+		vkDestroyImageView(m_VkDevice, residency.View, nullptr);
+	}
+
+	if (residency.Image != VK_NULL_HANDLE)
+	{
+		m_Allocator->DestroyImage(residency.Image, residency.Allocation);
+	}
+
+	residency = Residency();
+}
+
+TextureStreamer::Residency* TextureStreamer::UploadTarget(Texture& texture)
+{
+	// A finished pending image is always published straight away, so at most one of them is still loading
+	if (texture.Pending.Image != VK_NULL_HANDLE)
+	{
+		return &texture.Pending;
+	}
+
+	if (texture.Current.Image != VK_NULL_HANDLE && texture.Current.LoadedLevel != texture.Current.FirstLevel)
+	{
+		return &texture.Current;
+	}
+
+	return nullptr;
+}
+
+VkDeviceSize TextureStreamer::UploadLevel(const Texture& texture, Residency& residency)
+{
+	auto level = residency.LoadedLevel == UINT32_MAX ? (uint32_t)texture.Data.Levels.size() - 1 : residency.LoadedLevel - 1;
+	const auto& data = texture.Data.Levels[level];
+
+	m_StagingRing->UploadImage(residency.Image, level - residency.FirstLevel, { data.Width, data.Height }, texture.Data.BlockExtent,
+		texture.Data.BlockSize, data.Data);
+
+	residency.LoadedLevel = level;
+	return data.Size;
+}
+
+void TextureStreamer::Publish(Texture& texture)
+{
+	// The pending image takes over once it is complete, or as soon as it shows as much detail as the current one
+	auto& pending = texture.Pending;
+	auto& current = texture.Current;
+	if (pending.Image != VK_NULL_HANDLE)
+	{
+		if (current.Image != VK_NULL_HANDLE && pending.LoadedLevel != pending.FirstLevel && pending.LoadedLevel > current.LoadedLevel)
+		{
+			return;
+		}
+
+		Retire(current);
+		current = pending;
+		pending = Residency();
+	}
+	else if (current.View != VK_NULL_HANDLE)
+	{
+		m_DeletionQueue->Retire(current.View);
+	}
+
+	// Only the uploaded levels are visible, nothing samples the ones still on their way
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image = current.Image;
+	viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format = texture.Data.Format;
+	viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, current.LoadedLevel - current.FirstLevel, VK_REMAINING_MIP_LEVELS, 0, 1 };
+
+	Vk::Check(vkCreateImageView(m_VkDevice, &viewInfo, nullptr, &current.View));
+
+	// Frames in flight still read the old slot, so the new view gets a slot of its own
+	auto slot = m_Bindless->AddTexture(current.View, m_Sampler);
+	if (texture.Slot != UINT32_MAX)
+	{
+		m_Bindless->RemoveTexture(texture.Slot);
+	}
+
+	texture.Slot = slot;
+}
+
+void TextureStreamer::Retire(Residency& residency)
+{
+	if (residency.Image != VK_NULL_HANDLE)
+	{
+		m_ResidentBytes -= residency.Allocation.Size;
+		m_Retired.push_back(residency);
+	}
+
+	residency = Residency();
+}
+
+void TextureStreamer::Evict(Texture& texture)
+{
+	// An upgrade that has not taken over yet is dropped, the tail is small enough to upload right away
+	Retire(texture.Pending);
+	if (texture.Current.FirstLevel >= texture.TailLevel)
+	{
+		return;
+	}
+
+	texture.Pending = CreateResidency(texture, texture.TailLevel);
+	while (texture.Pending.Image != VK_NULL_HANDLE)
+	{
+		UploadLevel(texture, texture.Pending);
+		Publish(texture);
+	}
+}
+
+bool TextureStreamer::MakeRoom(VkDeviceSize size)
+{
+	while (m_ResidentBytes + size > m_Budget)
+	{
+		// Least recently used texture holding more than its tail, textures used this frame are never evicted
+		Texture* victim = nullptr;
+		for (auto& texture : m_Textures)
+		{
+			if (texture.Status != State::Resident || texture.LastUsed == m_Frame)
+			{
+				continue;
+			}
+
+			auto holdsChain = (texture.Current.Image != VK_NULL_HANDLE && texture.Current.FirstLevel < texture.TailLevel) ||
+				(texture.Pending.Image != VK_NULL_HANDLE && texture.Pending.FirstLevel < texture.TailLevel);
+			if (holdsChain && (victim == nullptr || texture.LastUsed < victim->LastUsed))
+			{
+				victim = &texture;
+			}
+		}
+
+		if (victim == nullptr)
+		{
+			return false;
+		}
+
+		Evict(*victim);
+	}
+
+	return true;
+}
+
+VkDeviceSize TextureStreamer::ChainSize(const Texture& texture, uint32_t firstLevel) const
+{
+	VkDeviceSize size = 0;
+	for (auto i = firstLevel; i < texture.Data.Levels.size(); i++)
+	{
+		size += texture.Data.Levels[i].Size;
+	}
+
+	return size;
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+#include "GpuAllocator.h"
+#include "StagingRing.h"
+#include "BindlessHeap.h"
+#include "DeletionQueue.h"
+#include "MappedFile.h"
+#include "Ktx2.h"
+
+// Streams KTX2 textures into the bindless heap. Files are mapped and parsed on worker threads, the main thread
+// uploads one level at a time through the staging ring, coarsest first, so a texture becomes visible at low
+// detail right away and sharpens over the following frames. Every loaded texture keeps its mip tail resident,
+// the full chains share a memory budget and the least recently used ones drop back to their tail to make room.
+class TextureStreamer
+{
+public:
+	static const VkDeviceSize DEFAULT_BUDGET = 256ull * 1024 * 1024;
+
+	// Soft limit, at least one level is uploaded per frame
+	static const VkDeviceSize UPLOAD_PER_FRAME = 16ull * 1024 * 1024;
+
+	// Levels no larger than this in either dimension form the mip tail
+	static const uint32_t TAIL_SIZE = 64;
+
+	// Handle that always samples the placeholder
+	static const uint32_t NONE = UINT32_MAX;
+
+	TextureStreamer();
+	virtual ~TextureStreamer();
+
+	// Zero threads picks one worker, decoding is mostly waiting on page faults
+	void Create(VkPhysicalDevice physicalDevice, VkDevice device, GpuAllocator* allocator, StagingRing* stagingRing, BindlessHeap* bindless,
+		DeletionQueue* deletionQueue, VkDeviceSize budget = DEFAULT_BUDGET, uint32_t threadCount = 0);
+	void Destroy();
+
+	// Never blocks. The texture samples a white placeholder until its mip tail is uploaded
+	uint32_t Load(const std::string& path);
+
+	// Marks the texture as used this frame, it asks for the full chain and is the last to be evicted
+	void Touch(uint32_t texture);
+
+	// Main thread, once per frame before the staging ring is flushed
+	void Update();
+
+	// Changes whenever more levels become visible, read it again every time commands are recorded
+	uint32_t BindlessIndex(uint32_t texture) const;
+
+	constexpr VkDeviceSize ResidentBytes() const { return m_ResidentBytes; }
+	constexpr VkDeviceSize Budget() const { return m_Budget; }
+
+private:
+	// One image holding the levels from FirstLevel down to the smallest one
+	struct Residency
+	{
+		VkImage Image = VK_NULL_HANDLE;
+		GpuAllocation Allocation;
+		VkImageView View = VK_NULL_HANDLE;
+		uint32_t FirstLevel = 0;
+
+		// Most detailed level uploaded so far, uploads go from the smallest level towards FirstLevel
+		uint32_t LoadedLevel = UINT32_MAX;
+	};
+
+	enum class State
+	{
+		Queued,
+		Failed,
+		Resident,
+	};
+
+	struct Texture
+	{
+		std::string Path;
+
+		// Main thread only, workers report through Decoded
+		State Status = State::Queued;
+
+		// Written by the worker, read by the main thread once it handed the texture back
+		MappedFile File;
+		Ktx2::Texture Data;
+		uint32_t TailLevel = 0;
+
+		// What the shaders see, and the image being filled to replace it
+		Residency Current;
+		Residency Pending;
+		uint32_t Slot = UINT32_MAX;
+		uint64_t LastUsed = 0;
+	};
+
+	// What a worker hands back, published under the mutex
+	struct Decoded
+	{
+		Texture* Target = nullptr;
+		bool Succeeded = false;
+		std::string Error;
+	};
+
+	void Run();
+	bool Decode(Texture& texture, std::string& error);
+	void CreatePlaceholder();
+	Residency CreateResidency(const Texture& texture, uint32_t firstLevel);
+	void DestroyResidency(Residency& residency);
+	Residency* UploadTarget(Texture& texture);
+	VkDeviceSize UploadLevel(const Texture& texture, Residency& residency);
+	void Publish(Texture& texture);
+	void Retire(Residency& residency);
+	void Evict(Texture& texture);
+	bool MakeRoom(VkDeviceSize size);
+	VkDeviceSize ChainSize(const Texture& texture, uint32_t firstLevel) const;
+
+	VkPhysicalDevice m_VkPhysicalDevice = VK_NULL_HANDLE;
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	GpuAllocator* m_Allocator = nullptr;
+	StagingRing* m_StagingRing = nullptr;
+	BindlessHeap* m_Bindless = nullptr;
+	DeletionQueue* m_DeletionQueue = nullptr;
+
+	VkSampler m_Sampler = VK_NULL_HANDLE;
+	Residency m_Placeholder;
+	uint32_t m_PlaceholderSlot = 0;
+
+	// Entries never move, workers hold pointers into the deque
+	std::deque<Texture> m_Textures;
+	VkDeviceSize m_Budget = DEFAULT_BUDGET;
+	VkDeviceSize m_ResidentBytes = 0;
+	uint64_t m_Frame = 1;
+
+	// Replaced images may still be the target of copies recorded this frame, they are retired on the next Update
+	std::vector<Residency> m_Retired;
+
+	// Background decoding
+	std::vector<std::thread> m_Threads;
+	std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	std::deque<Texture*> m_Requests;
+	std::vector<Decoded> m_Decoded;
+	bool m_Stop = false;
+};
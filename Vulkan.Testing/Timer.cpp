@@ -3,7 +3,7 @@
 
 Timer::Timer()
 {
-	__int64 countsPerSec = SDL_GetPerformanceFrequency();
+	int64_t countsPerSec = SDL_GetPerformanceFrequency();
 	m_SecondsPerCount = 1.0 / static_cast<double>(countsPerSec);
 
 	Reset();
@@ -15,7 +15,7 @@ Timer::~Timer()
 
 void Timer::Start()
 {
-	__int64 startTime = SDL_GetPerformanceCounter();
+	int64_t startTime = SDL_GetPerformanceCounter();
 	m_Active = true;
 
 	if (m_Stopped)
@@ -32,7 +32,7 @@ void Timer::Stop()
 {
 	if (!m_Stopped)
 	{
-		__int64 currTime = SDL_GetPerformanceCounter();
+		int64_t currTime = SDL_GetPerformanceCounter();
 
 		m_StopTime = currTime;
 		m_Stopped = true;
@@ -41,7 +41,7 @@ void Timer::Stop()
 
 void Timer::Reset()
 {
-	__int64 currTime = SDL_GetPerformanceCounter();
+	int64_t currTime = SDL_GetPerformanceCounter();
 
 	m_BaseTime = currTime;
 	m_PrevTime = currTime;
@@ -58,7 +58,7 @@ void Timer::Tick()
 		return;
 	}
 
-	__int64 currTime = SDL_GetPerformanceCounter();
+	int64_t currTime = SDL_GetPerformanceCounter();
 	m_CurrTime = currTime;
 
 	// Time difference between this frame and the previous.
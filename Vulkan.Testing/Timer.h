@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 class Timer
 {
 public:
@@ -21,11 +23,11 @@ protected:
 	double m_SecondsPerCount = 0.0;
 	double m_DeltaTime = 0.0;
 
-	__int64 m_BaseTime = 0;
-	__int64 m_PausedTime = 0;
-	__int64 m_StopTime = 0;
-	__int64 m_PrevTime = 0;
-	__int64 m_CurrTime = 0;
+	int64_t m_BaseTime = 0;
+	int64_t m_PausedTime = 0;
+	int64_t m_StopTime = 0;
+	int64_t m_PrevTime = 0;
+	int64_t m_CurrTime = 0;
 
 	bool m_Active = false;
 	bool m_Stopped = false;
@@ -0,0 +1,142 @@
+#include "UniformRing.h"
+#include "VkUtils.h"
+#include <algorithm>
+#include <stdexcept>
+
+UniformRing::UniformRing()
+{
+}
+
+UniformRing::~UniformRing()
+{
+}
+
+void UniformRing::Create(VkPhysicalDevice physicalDevice, VkDevice device, GpuAllocator* allocator, uint32_t regionCount, VkDeviceSize regionSize)
+{
+	m_VkDevice = device;
+	m_Allocator = allocator;
+	m_RegionCount = regionCount;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	m_Alignment = std::max<VkDeviceSize>(1, properties.limits.minUniformBufferOffsetAlignment);
+	m_Range = std::min<VkDeviceSize>(MAX_BLOCK_SIZE, properties.limits.maxUniformBufferRange);
+
+	// Regions start aligned, so every offset handed out is a valid dynamic offset
+	m_RegionSize = (regionSize + m_Alignment - 1) / m_Alignment * m_Alignment;
+
+	VkDescriptorSetLayoutBinding binding{};
+	binding.binding = 0;
+	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	binding.descriptorCount = 1;
+	binding.stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT;
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = 1;
+	layoutInfo.pBindings = &binding;
+
+	Vk::Check(vkCreateDescriptorSetLayout(m_VkDevice, &layoutInfo, nullptr, &m_Layout));
+
+	VkDescriptorPoolSize poolSize{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1 };
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.maxSets = 1;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+
+	Vk::Check(vkCreateDescriptorPool(m_VkDevice, &poolInfo, nullptr, &m_Pool));
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = m_Pool;
+	allocInfo.descriptorSetCount = 1;
+	allocInfo.pSetLayouts = &m_Layout;
+
+	Vk::Check(vkAllocateDescriptorSets(m_VkDevice, &allocInfo, &m_Set));
+
+	CreateBuffer();
+}
+
+void UniformRing::Destroy()
+{
+	vkDestroyDescriptorPool(m_VkDevice, m_Pool, nullptr);
+	vkDestroyDescriptorSetLayout(m_VkDevice, m_Layout, nullptr);
+	m_Pool = VK_NULL_HANDLE;
+	m_Layout = VK_NULL_HANDLE;
+	m_Set = VK_NULL_HANDLE;
+
+	if (m_Buffer != VK_NULL_HANDLE)
+	{
+		m_Allocator->DestroyBuffer(m_Buffer, m_Allocation);
+		m_Buffer = VK_NULL_HANDLE;
+	}
+}
+
+void UniformRing::Resize(uint32_t regionCount)
+{
+	m_Allocator->DestroyBuffer(m_Buffer, m_Allocation);
+	m_RegionCount = regionCount;
+	CreateBuffer();
+}
+
+void UniformRing::BeginFrame(uint32_t region)
+{
+	if (region >= m_RegionCount)
+	{
+		throw std::runtime_error("uniform ring region is out of range!");
+	}
+
+	m_RegionStart = region * m_RegionSize;
+	m_Head = 0;
+}
+
+UniformAllocation UniformRing::Allocate(VkDeviceSize size)
+{
+	if (size > m_Range)
+	{
+		throw std::runtime_error("uniform block is larger than the ring's descriptor range!");
+	}
+
+	// One atomic add per allocation, workers never take a lock
+	auto alignedSize = (size + m_Alignment - 1) / m_Alignment * m_Alignment;
+	auto offset = m_Head.fetch_add(alignedSize);
+	if (offset + alignedSize > m_RegionSize)
+	{
+		throw std::runtime_error("uniform ring region is full!");
+	}
+
+	UniformAllocation allocation;
+	allocation.Offset = (uint32_t)(m_RegionStart + offset);
+	allocation.Data = static_cast<char*>(m_Allocation.Mapped) + allocation.Offset;
+	return allocation;
+}
+
+void UniformRing::CreateBuffer()
+{
+	// The descriptor range reaches past an allocation at the very end, pad so it stays inside the buffer
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = m_RegionSize * m_RegionCount + m_Range;
+	bufferInfo.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	// Coherent, writes before the submit are visible without a flush
+	m_Buffer = m_Allocator->CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_Allocation);
+
+	VkDescriptorBufferInfo bufferDescriptor{};
+	bufferDescriptor.buffer = m_Buffer;
+	bufferDescriptor.offset = 0;
+	bufferDescriptor.range = m_Range;
+
+	VkWriteDescriptorSet write{};
+	write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	write.dstSet = m_Set;
+	write.dstBinding = 0;
+	write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	write.descriptorCount = 1;
+	write.pBufferInfo = &bufferDescriptor;
+
+	vkUpdateDescriptorSets(m_VkDevice, 1, &write, 0, nullptr);
+}
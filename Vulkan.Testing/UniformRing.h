@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+#include <vulkan/vulkan.hpp>
+#include "GpuAllocator.h"
+
+struct UniformAllocation
+{
+	// Where to write, stays mapped for the lifetime of the ring
+	void* Data = nullptr;
+
+	// Passed as the dynamic offset when binding the ring's set
+	uint32_t Offset = 0;
+};
+
+// Persistently mapped uniform memory split into one region per recorded command buffer. Allocations are
+// bump allocated from the current region, aligned to minUniformBufferOffsetAlignment, and reach the shaders
+// through a single dynamic uniform buffer descriptor, so per frame data is never mapped or updated one buffer at a time.
+class UniformRing
+{
+public:
+	static const VkDeviceSize DEFAULT_REGION_SIZE = 256ull * 1024;
+
+	// Range of the descriptor, the largest block a single allocation can hold
+	static const VkDeviceSize MAX_BLOCK_SIZE = 16ull * 1024;
+
+	UniformRing();
+	virtual ~UniformRing();
+
+	void Create(VkPhysicalDevice physicalDevice, VkDevice device, GpuAllocator* allocator, uint32_t regionCount, VkDeviceSize regionSize = DEFAULT_REGION_SIZE);
+	void Destroy();
+
+	// Regrows the buffer in place, the layout and set keep their handles. The GPU has to be done with the ring
+	void Resize(uint32_t regionCount);
+
+	// Starts over at the beginning of the region, the submission that last read it has to be finished
+	void BeginFrame(uint32_t region);
+
+	// Safe to call from recording workers, throws once the region is full
+	UniformAllocation Allocate(VkDeviceSize size);
+
+	template<typename T>
+	uint32_t Push(const T& value)
+	{
+		auto allocation = Allocate(sizeof(T));
+		std::memcpy(allocation.Data, &value, sizeof(T));
+		return allocation.Offset;
+	}
+
+	// The first allocation of a frame always lands here, so static command buffers can bake its offset
+	uint32_t RegionOffset(uint32_t region) const { return (uint32_t)(region * m_RegionSize); }
+
+	constexpr uint32_t RegionCount() const { return m_RegionCount; }
+	constexpr VkDescriptorSetLayout Layout() const { return m_Layout; }
+	constexpr VkDescriptorSet Set() const { return m_Set; }
+
+private:
+	void CreateBuffer();
+
+	VkDevice m_VkDevice = VK_NULL_HANDLE;
+	GpuAllocator* m_Allocator = nullptr;
+
+	VkBuffer m_Buffer = VK_NULL_HANDLE;
+	GpuAllocation m_Allocation;
+	VkDeviceSize m_Alignment = 1;
+	VkDeviceSize m_Range = 0;
+	VkDeviceSize m_RegionSize = 0;
+	uint32_t m_RegionCount = 0;
+
+	// The set only ever points at the whole ring, the dynamic offset picks the block
+	VkDescriptorSetLayout m_Layout = VK_NULL_HANDLE;
+	VkDescriptorPool m_Pool = VK_NULL_HANDLE;
+	VkDescriptorSet m_Set = VK_NULL_HANDLE;
+
+	VkDeviceSize m_RegionStart = 0;
+	std::atomic<VkDeviceSize> m_Head{ 0 };
+};
@@ -1,69 +1,111 @@
 #include "VkRenderer.h"
+#include "VkUtils.h"
+#include "Timer.h"
 #include <iostream>
 #include <set>
-#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <cstddef>
+#include <cerrno>
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
+const uint32_t MAX_FRAMES_IN_FLIGHT = 8;
+const uint32_t HEADLESS_IMAGE_COUNT = 3;
 
-namespace Vk
+VkRenderer::VkRenderer(SDL_Window* window, const RendererSettings& settings) : m_Window(window), m_Settings(settings), m_PipelineCache(settings.PipelineCachePath)
 {
-	inline void Check(VkResult result)
+	m_FramesInFlight = std::clamp(settings.FramesInFlight, 1u, MAX_FRAMES_IN_FLIGHT);
+
+	// A single indirect draw leaves nothing to split between workers
+	if (m_Settings.Indirect && m_Settings.Recording == RecordMode::Parallel)
 	{
-		if (result != VkResult::VK_SUCCESS)
-		{
-			throw std::exception();
-		}
+		std::cout << "Indirect drawing records on one thread, using per frame recording\n";
+		m_Settings.Recording = RecordMode::PerFrame;
 	}
 
-	static std::vector<char> readFile(const std::string& filename)
+	// Static command buffers would keep using the pipelines a reload replaces
+	if (m_Settings.HotReload && m_Settings.Recording == RecordMode::Static)
 	{
-		std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-		if (!file.is_open())
-		{
-			throw std::runtime_error("failed to open file!");
-		}
-
-		size_t fileSize = (size_t)file.tellg();
-		std::vector<char> buffer(fileSize);
-
-		file.seekg(0);
-		file.read(buffer.data(), fileSize);
-
-		file.close();
-		return buffer;
+		std::cout << "Shader hot reload re-records every frame, using per frame recording\n";
+		m_Settings.Recording = RecordMode::PerFrame;
 	}
-}
 
-VkRenderer::VkRenderer(SDL_Window* window) : m_Window(window)
-{
+	// Streamed textures move to a new bindless slot whenever they gain detail
+	if (!m_Settings.Textures.empty() && m_Settings.Recording == RecordMode::Static)
+	{
+		std::cout << "Texture streaming re-records every frame, using per frame recording\n";
+		m_Settings.Recording = RecordMode::PerFrame;
+	}
 }
 
 VkRenderer::~VkRenderer()
 {
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+	// Retired objects may reference pools and the device that are destroyed below
+	m_DeletionQueue.Flush();
+
+	for (size_t i = 0; i < m_FramesInFlight; i++) {
 		vkDestroySemaphore(m_VkDevice, renderFinishedSemaphores[i], nullptr);
 		vkDestroySemaphore(m_VkDevice, imageAvailableSemaphores[i], nullptr);
-		vkDestroyFence(m_VkDevice, inFlightFences[i], nullptr);
 	}
 
-	vkDestroyCommandPool(m_VkDevice, m_VkCommandPool, nullptr);
-	for (auto framebuffer : m_SwapChainFramebuffers) 
+	m_Timeline.Destroy();
+
+	m_GpuProfiler.Destroy();
+	for (auto& frame : m_FrameCommands)
 	{
-		vkDestroyFramebuffer(m_VkDevice, framebuffer, nullptr);
+		for (auto& worker : frame.Workers)
+		{
+			vkDestroyCommandPool(m_VkDevice, worker.Pool, nullptr);
+		}
+
+		vkDestroyCommandPool(m_VkDevice, frame.Pool, nullptr);
 	}
 
-	vkDestroyPipeline(m_VkDevice, m_VkPipeline, nullptr);
+	vkDestroyCommandPool(m_VkDevice, m_VkCommandPool, nullptr);
+	m_RenderGraph.Destroy();
+
+	m_ShaderManager.Destroy();
+	m_PipelineLibrary.Destroy();
+	m_PipelineCache.Report();
+	m_PipelineCache.Save();
+	m_ShaderArchive.Close();
+	m_PipelineCache.Destroy();
 	vkDestroyPipelineLayout(m_VkDevice, m_PipelineLayout, nullptr);
-	vkDestroyRenderPass(m_VkDevice, m_RenderPass, nullptr);
+	m_TextureStreamer.Destroy();
+	m_DescriptorArena.Destroy();
+	m_Bindless.Destroy();
+	m_UniformRing.Destroy();
 	for (auto imageView : m_SwapChainImageViews)
 	{
 		vkDestroyImageView(m_VkDevice, imageView, nullptr);
 	}
 
-	vkDestroySwapchainKHR(m_VkDevice, m_VkSwapchainKHR, nullptr);
+	if (IsHeadless())
+	{
+		for (size_t i = 0; i < m_SwapChainImages.size(); i++)
+		{
+			m_Allocator.DestroyImage(m_SwapChainImages[i], m_OffscreenAllocations[i]);
+		}
+	}
+	else
+	{
+		vkDestroySwapchainKHR(m_VkDevice, m_VkSwapchainKHR, nullptr);
+	}
+
+	m_Culling.Destroy();
+	m_Allocator.DestroyBuffer(m_DrawCountBuffer, m_DrawCountAllocation);
+	m_Allocator.DestroyBuffer(m_IndirectBuffer, m_IndirectAllocation);
+	m_Allocator.DestroyBuffer(m_InstanceBuffer, m_InstanceAllocation);
+	m_Allocator.DestroyBuffer(m_IndexBuffer, m_IndexAllocation);
+	m_Allocator.DestroyBuffer(m_VertexBuffer, m_VertexAllocation);
+	m_StagingRing.Destroy();
+	m_Allocator.Destroy();
 	vkDestroyDevice(m_VkDevice, nullptr);
-	vkDestroySurfaceKHR(m_VkInstance, m_VkSurfaceKHR, nullptr);
+	if (m_VkSurfaceKHR != VK_NULL_HANDLE)
+	{
+		vkDestroySurfaceKHR(m_VkInstance, m_VkSurfaceKHR, nullptr);
+	}
 	vkDestroyInstance(m_VkInstance, nullptr);
 }
 
@@ -72,39 +114,94 @@ bool VkRenderer::Create()
 	CreateVkInstance();
 	PickPhysicalDevice();
 	CreateLogicalDevice();
-	CreateSwapchain();
+	m_PipelineCache.Load(m_VkPhysicalDevice, m_VkDevice);
+	m_Allocator.Create(m_VkPhysicalDevice, m_VkDevice);
+	m_DeletionQueue.Create(m_VkDevice, &m_Allocator, &m_Timeline);
+	m_RenderGraph.Create(m_VkDevice, &m_Allocator, &m_DeletionQueue);
+
+	// Hot reload writes loose files that the archive would shadow
+	if (!m_Settings.HotReload)
+	{
+		m_ShaderArchive.Open(m_Settings.ShaderArchivePath);
+	}
+
+	m_PipelineLibrary.Create(m_VkDevice, &m_PipelineCache, &m_ShaderArchive, &m_DeletionQueue, m_ExtendedDynamicState);
+
+	if (m_Settings.HotReload)
+	{
+		m_ShaderManager.Watch("VertexShader.vert", "shaders/vert.spv");
+		m_ShaderManager.Watch("FragmentShader.frag", "shaders/frag.spv");
+		m_ShaderManager.Create(m_Settings.ShaderSourcePath);
+	}
+	m_StagingRing.Create(m_VkDevice, &m_Allocator, m_TransferFamily.value(), m_TransferQueue, m_GraphicsFamily.value(), graphicsQueue);
+
+	if (IsHeadless())
+	{
+		CreateOffscreenImages();
+	}
+	else
+	{
+		CreateSwapchain();
+	}
+
 	CreateImageViews();
-	CreateRenderPass();
+	ChooseRenderTargetFormats();
+	m_Bindless.Create(m_VkPhysicalDevice, m_VkDevice, &m_DeletionQueue);
+
+	// Uniform regions, descriptor arenas and profiler queries all follow the recorded command buffers
+	auto frameSlots = std::max((uint32_t)m_SwapChainImages.size(), m_FramesInFlight);
+	m_UniformRing.Create(m_VkPhysicalDevice, m_VkDevice, &m_Allocator, frameSlots);
+	m_DescriptorArena.Create(m_VkDevice, &m_DeletionQueue, frameSlots);
+
+	m_TextureStreamer.Create(m_VkPhysicalDevice, m_VkDevice, &m_Allocator, &m_StagingRing, &m_Bindless, &m_DeletionQueue,
+		(VkDeviceSize)m_Settings.TextureBudget * 1024 * 1024);
+	for (const auto& path : m_Settings.Textures)
+	{
+		m_SceneTextures.push_back(m_TextureStreamer.Load(path));
+	}
+
 	CreateGraphicsPipeline();
-	CreateFramebuffers();
+	CreateScene();
+	BuildRenderGraph();
 	CreateCommandPool();
-	CreateCommandBuffers();
+
+	m_GpuProfiler.Create(m_VkPhysicalDevice, m_VkDevice, m_GraphicsFamily.value(), frameSlots);
+
+	if (m_Settings.Recording == RecordMode::Static)
+	{
+		CreateCommandBuffers();
+	}
+	else
+	{
+		CreateFrameCommandPools();
+	}
+
 	createSyncObjects();
 
+	m_Allocator.Report();
 	std::cout << "Success\n";
 	return true;
 }
 
 void VkRenderer::createSyncObjects() {
-	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
-	imagesInFlight.resize(m_SwapChainImages.size(), VK_NULL_HANDLE);
+	imageAvailableSemaphores.resize(m_FramesInFlight);
+	renderFinishedSemaphores.resize(m_FramesInFlight);
+	m_FrameValues.resize(m_FramesInFlight, 0);
+	m_ImageValues.resize(m_SwapChainImages.size(), 0);
+	m_ProfilerSlots.resize(m_FramesInFlight, UINT32_MAX);
 
 	VkSemaphoreCreateInfo semaphoreInfo{};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	VkFenceCreateInfo fenceInfo{};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+	// Presentation only works with binary semaphores, everything else waits on the timeline
+	for (size_t i = 0; i < m_FramesInFlight; i++) {
 		if (vkCreateSemaphore(m_VkDevice, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(m_VkDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(m_VkDevice, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS) {
+			vkCreateSemaphore(m_VkDevice, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS) {
 			throw std::runtime_error("failed to create synchronization objects for a frame!");
 		}
 	}
+
+	m_Timeline.Create(m_VkDevice);
 }
 
 void VkRenderer::DrawFrame()
@@ -145,15 +242,70 @@ void VkRenderer::DrawFrame()
 
 	//vkQueuePresentKHR(m_VkPresentQueue, &presentInfo);
 
-	vkWaitForFences(m_VkDevice, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+	// The frame slot is free once the timeline passed its last submission, this is the only wait when the GPU is behind
+	m_Timeline.Wait(m_FrameValues[currentFrame]);
+
+	// The last submission of this frame has finished so its timestamps can be read without stalling
+	if (m_ProfilerSlots[currentFrame] != UINT32_MAX)
+	{
+		m_GpuProfiler.Collect(m_ProfilerSlots[currentFrame]);
+	}
+
+	m_DeletionQueue.Collect();
+	m_StagingRing.Update();
+
+	// Only the variants built from an edited module are rebuilt, the rest keep their pipelines
+	auto changedShaders = m_ShaderManager.TakeChanged();
+	if (!changedShaders.empty())
+	{
+		m_PipelineLibrary.Reload(changedShaders);
+	}
+
+	m_PipelineLibrary.Update();
+
+	// Offscreen targets are cycled round-robin, there is nothing to acquire or present
+	if (IsHeadless())
+	{
+		DrawFrameHeadless();
+		return;
+	}
+
+	if (m_SwapchainDirty)
+	{
+		RecreateSwapchain();
+		if (m_SwapchainDirty)
+		{
+			// Minimized, nothing to draw to
+			return;
+		}
+	}
 
 	uint32_t imageIndex;
-	vkAcquireNextImageKHR(m_VkDevice, m_VkSwapchainKHR, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+	auto result = vkAcquireNextImageKHR(m_VkDevice, m_VkSwapchainKHR, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
 
-	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
-		vkWaitForFences(m_VkDevice, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+	// The semaphore is not signalled when acquiring fails so the frame can simply be skipped
+	if (result == VK_ERROR_OUT_OF_DATE_KHR)
+	{
+		m_SwapchainDirty = true;
+		return;
 	}
-	imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+
+	if (result != VK_SUBOPTIMAL_KHR)
+	{
+		Vk::Check(result);
+	}
+
+	// Returns straight away unless the image came back while an older frame still renders into it
+	m_Timeline.Wait(m_ImageValues[imageIndex]);
+	m_ProfilerSlots[currentFrame] = FrameSlot(imageIndex);
+	UpdateFrameUniforms(imageIndex);
+	StreamTextures();
+
+	// Per frame modes record now that the pools of this frame are free again
+	VkCommandBuffer commandBuffer = m_Settings.Recording == RecordMode::Static ? m_CommandBuffers[imageIndex] : RecordFrame(imageIndex);
+
+	// Uploads queued since the last frame are submitted ahead of it on the same queue
+	m_StagingRing.Flush();
 
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -165,15 +317,28 @@ void VkRenderer::DrawFrame()
 	submitInfo.pWaitDstStageMask = waitStages;
 
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &m_CommandBuffers[imageIndex];
-
-	VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+
+	// Binary values are ignored but the counts have to match
+	auto signalValue = m_Timeline.Next();
+	m_FrameValues[currentFrame] = signalValue;
+	m_ImageValues[imageIndex] = signalValue;
+
+	uint64_t waitValues[] = { 0 };
+	uint64_t signalValues[] = { 0, signalValue };
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.waitSemaphoreValueCount = 1;
+	timelineInfo.pWaitSemaphoreValues = waitValues;
+	timelineInfo.signalSemaphoreValueCount = 2;
+	timelineInfo.pSignalSemaphoreValues = signalValues;
+	submitInfo.pNext = &timelineInfo;
+
+	VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame], m_Timeline.Semaphore() };
+	submitInfo.signalSemaphoreCount = 2;
 	submitInfo.pSignalSemaphores = signalSemaphores;
 
-	vkResetFences(m_VkDevice, 1, &inFlightFences[currentFrame]);
-
-	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
 		throw std::runtime_error("failed to submit draw command buffer!");
 	}
 
@@ -189,24 +354,78 @@ void VkRenderer::DrawFrame()
 
 	presentInfo.pImageIndices = &imageIndex;
 
-	vkQueuePresentKHR(m_VkPresentQueue, &presentInfo);
+	// Suboptimal images were still presented, recreate before the next acquire
+	result = vkQueuePresentKHR(m_VkPresentQueue, &presentInfo);
+	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
+	{
+		m_SwapchainDirty = true;
+	}
+	else
+	{
+		Vk::Check(result);
+	}
+
+	currentFrame = (currentFrame + 1) % m_FramesInFlight;
+}
+
+void VkRenderer::DrawFrameHeadless()
+{
+	uint32_t imageIndex = m_OffscreenIndex;
+	m_OffscreenIndex = (m_OffscreenIndex + 1) % (uint32_t)m_SwapChainImages.size();
+
+	// Returns straight away unless the image came back while an older frame still renders into it
+	m_Timeline.Wait(m_ImageValues[imageIndex]);
+	m_ProfilerSlots[currentFrame] = FrameSlot(imageIndex);
+	UpdateFrameUniforms(imageIndex);
+	StreamTextures();
+
+	// Per frame modes record now that the pools of this frame are free again
+	VkCommandBuffer commandBuffer = m_Settings.Recording == RecordMode::Static ? m_CommandBuffers[imageIndex] : RecordFrame(imageIndex);
+
+	// Uploads queued since the last frame are submitted ahead of it on the same queue
+	m_StagingRing.Flush();
+
+	auto signalValue = m_Timeline.Next();
+	m_FrameValues[currentFrame] = signalValue;
+	m_ImageValues[imageIndex] = signalValue;
+
+	VkTimelineSemaphoreSubmitInfo timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &signalValue;
+
+	auto timeline = m_Timeline.Semaphore();
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.pNext = &timelineInfo;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &timeline;
 
-	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit draw command buffer!");
+	}
+
+	currentFrame = (currentFrame + 1) % m_FramesInFlight;
 }
 
 void VkRenderer::CreateVkInstance()
 {
 	// Get WSI extensions from SDL (we can add more if we like - we just can't remove these)
-	unsigned extension_count;
-	if (!SDL_Vulkan_GetInstanceExtensions(m_Window, &extension_count, NULL))
+	if (!IsHeadless())
 	{
-		std::cout << "Could not get the number of required instance extensions from SDL." << std::endl;
-	}
+		unsigned extension_count;
+		if (!SDL_Vulkan_GetInstanceExtensions(m_Window, &extension_count, NULL))
+		{
+			std::cout << "Could not get the number of required instance extensions from SDL." << std::endl;
+		}
 
-	m_InstanceExtensions.resize(extension_count);
-	if (!SDL_Vulkan_GetInstanceExtensions(m_Window, &extension_count, m_InstanceExtensions.data()))
-	{
-		std::cout << "Could not get the names of required instance extensions from SDL." << std::endl;
+		m_InstanceExtensions.resize(extension_count);
+		if (!SDL_Vulkan_GetInstanceExtensions(m_Window, &extension_count, m_InstanceExtensions.data()))
+		{
+			std::cout << "Could not get the names of required instance extensions from SDL." << std::endl;
+		}
 	}
 
 	m_InstanceExtensions.push_back(VK_EXT_DEBUG_REPORT_EXTENSION_NAME);
@@ -224,7 +443,7 @@ void VkRenderer::CreateVkInstance()
 	app_info.applicationVersion = 1;
 	app_info.pEngineName = "Vulkan";
 	app_info.engineVersion = 1;
-	app_info.apiVersion = VK_API_VERSION_1_0;
+	app_info.apiVersion = VK_API_VERSION_1_2;
 
 	VkInstanceCreateInfo inst_info = {};
 	inst_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -237,6 +456,11 @@ void VkRenderer::CreateVkInstance()
 	Vk::Check(vkCreateInstance(&inst_info, nullptr, &m_VkInstance));
 
 	// Create surface
+	if (IsHeadless())
+	{
+		return;
+	}
+
 	if (!SDL_Vulkan_CreateSurface(m_Window, m_VkInstance, &m_VkSurfaceKHR))
 	{
 		std::cout << "Could not create a Vulkan surface." << std::endl;
@@ -252,30 +476,202 @@ void VkRenderer::PickPhysicalDevice()
 	std::vector<VkPhysicalDevice> devices(deviceCount);
 	vkEnumeratePhysicalDevices(m_VkInstance, &deviceCount, devices.data());
 
-	// Set physical device to default
-	m_VkPhysicalDevice = devices[0];
+	if (devices.empty())
+	{
+		throw std::runtime_error("no Vulkan capable GPU found!");
+	}
+
+	// An explicit choice on the command line wins over the environment
+	std::string requested = m_Settings.Device;
+	if (requested.empty() && std::getenv("VKTEST_DEVICE"))
+	{
+		requested = std::getenv("VKTEST_DEVICE");
+	}
+
+	// Score every device, unsupported ones are listed but never picked
+	VkPhysicalDevice best = VK_NULL_HANDLE;
+	VkPhysicalDevice chosen = VK_NULL_HANDLE;
+	int bestScore = -1;
+	for (size_t i = 0; i < devices.size(); i++)
+	{
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(devices[i], &properties);
+
+		int score = RateDevice(devices[i]);
+		std::cout << "GPU " << i << ": " << properties.deviceName;
+		std::cout << (score < 0 ? " (unsupported)" : " (score " + std::to_string(score) + ")") << '\n';
+
+		if (score > bestScore)
+		{
+			best = devices[i];
+			bestScore = score;
+		}
+
+		if (!requested.empty() && chosen == VK_NULL_HANDLE && MatchesDevice(requested, i, properties.deviceName))
+		{
+			if (score < 0)
+			{
+				std::cout << "Requested GPU " << i << " misses required features\n";
+				continue;
+			}
+
+			chosen = devices[i];
+		}
+	}
+
+	if (!requested.empty() && chosen == VK_NULL_HANDLE)
+	{
+		std::cout << "No supported GPU matches \"" << requested << "\", picking the highest scoring one\n";
+	}
+
+	if (best == VK_NULL_HANDLE)
+	{
+		throw std::runtime_error("no GPU supports the features this renderer needs!");
+	}
+
+	m_VkPhysicalDevice = chosen != VK_NULL_HANDLE ? chosen : best;
 
-	// Device properties
+	// Print GPU name
 	VkPhysicalDeviceProperties deviceProperties;
 	vkGetPhysicalDeviceProperties(m_VkPhysicalDevice, &deviceProperties);
+	std::cout << "Using " << deviceProperties.deviceName << '\n';
 
-	VkPhysicalDeviceFeatures deviceFeatures;
-	vkGetPhysicalDeviceFeatures(m_VkPhysicalDevice, &deviceFeatures);
+	// Scoring left the families of the last rated device behind
+	SelectQueueFamilies(m_VkPhysicalDevice);
+	std::cout << "Queue families: graphics " << m_GraphicsFamily.value() << ", transfer " << m_TransferFamily.value() << '\n';
+}
 
-	// Print GPU name
-	std::cout << deviceProperties.deviceName << '\n';
+int VkRenderer::RateDevice(VkPhysicalDevice device)
+{
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(device, &properties);
+
+	// Frame pacing is built on timeline semaphores
+	if (properties.apiVersion < VK_API_VERSION_1_2)
+	{
+		return -1;
+	}
+
+	VkPhysicalDeviceVulkan12Features features12{};
+	features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+	VkPhysicalDeviceFeatures2 features{};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &features12;
+	vkGetPhysicalDeviceFeatures2(device, &features);
+
+	// Shaders reach every resource through the bindless heap
+	if (!features12.timelineSemaphore || !SupportsBindless(features.features, features12))
+	{
+		return -1;
+	}
+
+	// Presenting needs the swapchain extension
+	if (!IsHeadless())
+	{
+		uint32_t extensionCount = 0;
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+		std::vector<VkExtensionProperties> extensions(extensionCount);
+		vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, extensions.data());
+
+		auto swapchain = std::find_if(extensions.begin(), extensions.end(), [](const VkExtensionProperties& extension)
+		{
+			return std::strcmp(extension.extensionName, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0;
+		});
+
+		if (swapchain == extensions.end())
+		{
+			return -1;
+		}
+	}
+
+	if (!SelectQueueFamilies(device))
+	{
+		return -1;
+	}
+
+	// Discrete GPUs first, software rasterizers only as a last resort
+	int score = 0;
+	switch (properties.deviceType)
+	{
+	case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score += 10000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score += 1000; break;
+	case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score += 500; break;
+	case VK_PHYSICAL_DEVICE_TYPE_CPU: break;
+	default: score += 100; break;
+	}
+
+	// Device local memory breaks ties between GPUs of the same type, one point per 256 MiB
+	VkPhysicalDeviceMemoryProperties memory;
+	vkGetPhysicalDeviceMemoryProperties(device, &memory);
+	for (uint32_t i = 0; i < memory.memoryHeapCount; i++)
+	{
+		if (memory.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+		{
+			score += (int)(memory.memoryHeaps[i].size >> 28);
+		}
+	}
+
+	// A dedicated transfer queue lets uploads run next to graphics
+	if (m_TransferFamily != m_GraphicsFamily)
+	{
+		score += 50;
+	}
+
+	return score;
+}
+
+bool VkRenderer::MatchesDevice(const std::string& requested, size_t index, const char* name)
+{
+	// A plain number selects by enumeration order, one too large to parse matches no device
+	if (!requested.empty() && std::all_of(requested.begin(), requested.end(), [](char c) { return std::isdigit((unsigned char)c); }))
+	{
+		errno = 0;
+		auto value = std::strtoull(requested.c_str(), nullptr, 10);
+		return errno != ERANGE && value == index;
+	}
+
+	// Anything else is a case insensitive part of the device name
+	auto lower = [](std::string text)
+	{
+		std::transform(text.begin(), text.end(), text.begin(), [](char c) { return (char)std::tolower((unsigned char)c); });
+		return text;
+	};
+
+	return lower(name).find(lower(requested)) != std::string::npos;
+}
+
+bool VkRenderer::SupportsBindless(const VkPhysicalDeviceFeatures& features, const VkPhysicalDeviceVulkan12Features& features12)
+{
+	// The vertex shader picks its storage buffer from a push constant, the fragment shader its texture per draw
+	if (!features.shaderStorageBufferArrayDynamicIndexing || !features.shaderSampledImageArrayDynamicIndexing ||
+		!features12.shaderSampledImageArrayNonUniformIndexing)
+	{
+		return false;
+	}
+
+	return features12.descriptorIndexing && features12.runtimeDescriptorArray && features12.descriptorBindingPartiallyBound && features12.descriptorBindingStorageBufferUpdateAfterBind &&
+		features12.descriptorBindingSampledImageUpdateAfterBind && features12.descriptorBindingUpdateUnusedWhilePending;
+}
+
+bool VkRenderer::SelectQueueFamilies(VkPhysicalDevice device)
+{
+	m_GraphicsFamily.reset();
+	m_PresentFamily.reset();
+	m_TransferFamily.reset();
 
 	// Queue families
 	uint32_t queueFamilyCount = 0;
-	vkGetPhysicalDeviceQueueFamilyProperties(m_VkPhysicalDevice, &queueFamilyCount, nullptr);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
 
 	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-	vkGetPhysicalDeviceQueueFamilyProperties(m_VkPhysicalDevice, &queueFamilyCount, queueFamilies.data());
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
-	// Find graphic queue for graphics
+	// Find graphic queue for graphics, it also runs the culling pass so it needs compute
 	for (size_t i = 0; i < queueFamilies.size(); i++)
 	{
-		if (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		if ((queueFamilies[i].queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)) == (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))
 		{
 			m_GraphicsFamily = (uint32_t)i;
 			break;
@@ -284,22 +680,64 @@ void VkRenderer::PickPhysicalDevice()
 
 	if (!m_GraphicsFamily.has_value())
 	{
-		std::cout << "No graphics queue found\n";
+		return false;
+	}
+
+	// A dedicated transfer queue runs uploads next to graphics, it has neither the graphics nor the compute bit.
+	// There is no async compute queue, the cull pass feeds the draws of the same frame so it could not overlap them
+	if (m_Settings.DedicatedQueues)
+	{
+		for (size_t i = 0; i < queueFamilies.size(); i++)
+		{
+			// Texture uploads copy whole mips and chunks of them, a coarser image granularity could not copy the edges
+			auto flags = queueFamilies[i].queueFlags;
+			auto granularity = queueFamilies[i].minImageTransferGranularity;
+			bool texelGranularity = granularity.width == 1 && granularity.height == 1 && granularity.depth == 1;
+			if (!m_TransferFamily.has_value() && texelGranularity && (flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			{
+				m_TransferFamily = (uint32_t)i;
+			}
+		}
+	}
+
+	if (!m_TransferFamily.has_value())
+	{
+		m_TransferFamily = m_GraphicsFamily;
 	}
 
+	// Headless rendering never presents, the graphics queue is only used for submission
+	if (IsHeadless())
+	{
+		m_PresentFamily = m_GraphicsFamily;
+		return true;
+	}
+
+	// Prefer presenting from the graphics family, any other family that can present works too
 	VkBool32 presentSupport = false;
-	Vk::Check(vkGetPhysicalDeviceSurfaceSupportKHR(m_VkPhysicalDevice, m_GraphicsFamily.value(), m_VkSurfaceKHR, &presentSupport));
+	Vk::Check(vkGetPhysicalDeviceSurfaceSupportKHR(device, m_GraphicsFamily.value(), m_VkSurfaceKHR, &presentSupport));
 	if (presentSupport)
 	{
 		m_PresentFamily = m_GraphicsFamily;
+		return true;
 	}
+
+	for (size_t i = 0; i < queueFamilies.size() && !m_PresentFamily.has_value(); i++)
+	{
+		Vk::Check(vkGetPhysicalDeviceSurfaceSupportKHR(device, (uint32_t)i, m_VkSurfaceKHR, &presentSupport));
+		if (presentSupport)
+		{
+			m_PresentFamily = (uint32_t)i;
+		}
+	}
+
+	return m_PresentFamily.has_value();
 }
 
 void VkRenderer::CreateLogicalDevice()
 {
 	// Specifying the queues to be created
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-	std::set<uint32_t> uniqueQueueFamilies = { m_GraphicsFamily.value(), m_PresentFamily.value() };
+	std::set<uint32_t> uniqueQueueFamilies = { m_GraphicsFamily.value(), m_PresentFamily.value(), m_TransferFamily.value() };
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies)
@@ -313,11 +751,13 @@ void VkRenderer::CreateLogicalDevice()
 	}
 
 	// Device extensions
-	const std::vector<const char*> deviceExtensions =
+	std::vector<const char*> deviceExtensions;
+	if (!IsHeadless())
 	{
-		VK_KHR_SWAPCHAIN_EXTENSION_NAME
-	};
+		deviceExtensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+	}
 
+	std::set<std::string> availableNames;
 	{
 		uint32_t extensionCount;
 		vkEnumerateDeviceExtensionProperties(m_VkPhysicalDevice, nullptr, &extensionCount, nullptr);
@@ -329,6 +769,7 @@ void VkRenderer::CreateLogicalDevice()
 		for (const auto& extension : availableExtensions)
 		{
 			requiredExtensions.erase(extension.extensionName);
+			availableNames.insert(extension.extensionName);
 		}
 
 		if (!requiredExtensions.empty())
@@ -337,17 +778,93 @@ void VkRenderer::CreateLogicalDevice()
 		}
 	}
 
+	// Optional, lets the GPU decide how many indirect draws run
+	auto drawIndirectCount = availableNames.count(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME) > 0;
+	if (drawIndirectCount)
+	{
+		deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+
 	// Specifying device features
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(m_VkPhysicalDevice, &supportedFeatures);
+
 	VkPhysicalDeviceFeatures deviceFeatures{};
+	deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	deviceFeatures.drawIndirectFirstInstance = supportedFeatures.drawIndirectFirstInstance;
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+	// Indexing into the bindless arrays, SupportsBindless already checked for them
+	deviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+	deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+	m_EnabledFeatures = deviceFeatures;
+
+	// Frame synchronization is built on timeline semaphores, core since Vulkan 1.2
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_VkPhysicalDevice, &properties);
+	if (properties.apiVersion < VK_API_VERSION_1_2)
+	{
+		throw std::runtime_error("Vulkan 1.2 is required!");
+	}
+
+	VkPhysicalDeviceExtendedDynamicStateFeaturesEXT supportedDynamicState{};
+	supportedDynamicState.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+
+	VkPhysicalDeviceVulkan12Features supported12{};
+	supported12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	supported12.pNext = &supportedDynamicState;
+
+	VkPhysicalDeviceFeatures2 supportedFeatures2{};
+	supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	supportedFeatures2.pNext = &supported12;
+	vkGetPhysicalDeviceFeatures2(m_VkPhysicalDevice, &supportedFeatures2);
+
+	if (!supported12.timelineSemaphore)
+	{
+		throw std::runtime_error("timeline semaphores are not supported!");
+	}
+
+	if (!SupportsBindless(supportedFeatures2.features, supported12))
+	{
+		throw std::runtime_error("descriptor indexing is not supported!");
+	}
+
+	VkPhysicalDeviceVulkan12Features features12{};
+	features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+	features12.timelineSemaphore = VK_TRUE;
+
+	// Descriptor indexing, formerly VK_EXT_descriptor_indexing and core since Vulkan 1.2
+	features12.descriptorIndexing = VK_TRUE;
+	features12.runtimeDescriptorArray = VK_TRUE;
+	features12.descriptorBindingPartiallyBound = VK_TRUE;
+	features12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+	features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	features12.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+	// Optional, pipelines that differ only in rasterizer or depth state collapse into one
+	m_ExtendedDynamicState = m_Settings.ExtendedDynamicState && supportedDynamicState.extendedDynamicState &&
+		availableNames.count(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME) > 0;
+
+	VkPhysicalDeviceExtendedDynamicStateFeaturesEXT dynamicStateFeatures{};
+	dynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+	dynamicStateFeatures.extendedDynamicState = VK_TRUE;
+
+	if (m_ExtendedDynamicState)
+	{
+		deviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+		features12.pNext = &dynamicStateFeatures;
+	}
 
 	// Creating the logical device
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = &features12;
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.queueCreateInfoCount = (uint32_t)queueCreateInfos.size();
 	createInfo.pEnabledFeatures = &deviceFeatures;
 	createInfo.enabledExtensionCount = (uint32_t)deviceExtensions.size();
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	createInfo.ppEnabledExtensionNames = deviceExtensions.size() ? deviceExtensions.data() : nullptr;
 
 	createInfo.enabledLayerCount = static_cast<uint32_t>(m_ValidationLayers.size());
 	createInfo.ppEnabledLayerNames = m_ValidationLayers.data();
@@ -356,6 +873,12 @@ void VkRenderer::CreateLogicalDevice()
 
 	vkGetDeviceQueue(m_VkDevice, m_GraphicsFamily.value(), 0, &graphicsQueue);
 	vkGetDeviceQueue(m_VkDevice, m_PresentFamily.value(), 0, &m_VkPresentQueue);
+	vkGetDeviceQueue(m_VkDevice, m_TransferFamily.value(), 0, &m_TransferQueue);
+
+	if (drawIndirectCount)
+	{
+		m_vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(m_VkDevice, "vkCmdDrawIndexedIndirectCountKHR");
+	}
 }
 
 void VkRenderer::CreateSwapchain()
@@ -386,7 +909,7 @@ void VkRenderer::CreateSwapchain()
 	m_PresentModes.resize(presentModeCount);
 	Vk::Check(vkGetPhysicalDeviceSurfacePresentModesKHR(m_VkPhysicalDevice, m_VkSurfaceKHR, &presentModeCount, m_PresentModes.data()));
 
-	m_PresentMode = m_PresentModes[0];
+	m_PresentMode = ChoosePresentMode();
 
 	// SDL THING
 	auto width = 0, height = 0;
@@ -406,7 +929,19 @@ void VkRenderer::CreateSwapchain()
 	createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
 	createInfo.surface = m_VkSurfaceKHR;
 
-	createInfo.minImageCount = m_Capabilities.minImageCount + 1;
+	// Mailbox needs a spare image to replace, otherwise one more than the minimum avoids waiting on the driver
+	auto minImageCount = m_Capabilities.minImageCount + 1;
+	if (m_PresentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+	{
+		minImageCount = std::max(minImageCount, 3u);
+	}
+
+	if (m_Capabilities.maxImageCount > 0)
+	{
+		minImageCount = std::min(minImageCount, m_Capabilities.maxImageCount);
+	}
+
+	createInfo.minImageCount = minImageCount;
 	createInfo.imageFormat = m_Format.format;
 	createInfo.imageColorSpace = m_Format.colorSpace;
 	createInfo.imageExtent = m_Extent;
@@ -431,7 +966,7 @@ void VkRenderer::CreateSwapchain()
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	createInfo.presentMode = m_PresentMode;
 	createInfo.clipped = VK_TRUE;
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	createInfo.oldSwapchain = m_VkSwapchainKHR;
 
 	Vk::Check(vkCreateSwapchainKHR(m_VkDevice, &createInfo, nullptr, &m_VkSwapchainKHR));
 
@@ -443,6 +978,152 @@ void VkRenderer::CreateSwapchain()
 	vkGetSwapchainImagesKHR(m_VkDevice, m_VkSwapchainKHR, &imageCount, m_SwapChainImages.data());
 }
 
+void VkRenderer::CreateOffscreenImages()
+{
+	// Pick a format we can render to
+	m_Format = { VK_FORMAT_B8G8R8A8_SRGB, VK_COLOR_SPACE_SRGB_NONLINEAR_KHR };
+
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(m_VkPhysicalDevice, m_Format.format, &formatProperties);
+	if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT))
+	{
+		m_Format.format = VK_FORMAT_R8G8B8A8_UNORM;
+	}
+
+	m_Extent = { m_Settings.Width, m_Settings.Height };
+
+	// Create the images in device local memory
+	m_SwapChainImages.resize(HEADLESS_IMAGE_COUNT);
+	m_OffscreenAllocations.resize(HEADLESS_IMAGE_COUNT);
+	for (uint32_t i = 0; i < HEADLESS_IMAGE_COUNT; i++)
+	{
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.format = m_Format.format;
+		imageInfo.extent = { m_Extent.width, m_Extent.height, 1 };
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+		m_SwapChainImages[i] = m_Allocator.CreateImage(imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_OffscreenAllocations[i]);
+	}
+}
+
+VkPresentModeKHR VkRenderer::ChoosePresentMode()
+{
+	// Preferred modes per policy, FIFO is the only one the spec guarantees so it is always the last resort
+	std::vector<VkPresentModeKHR> preferred;
+	switch (m_Settings.Pacing)
+	{
+	case PresentPolicy::LowLatency:
+		preferred = { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR };
+		break;
+
+	case PresentPolicy::Uncapped:
+		preferred = { VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR };
+		break;
+
+	case PresentPolicy::Adaptive:
+		preferred = { VK_PRESENT_MODE_FIFO_RELAXED_KHR };
+		break;
+
+	case PresentPolicy::PowerSaving:
+		break;
+	}
+
+	for (auto mode : preferred)
+	{
+		if (std::find(m_PresentModes.begin(), m_PresentModes.end(), mode) != m_PresentModes.end())
+		{
+			return mode;
+		}
+	}
+
+	return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+void VkRenderer::OnResize()
+{
+	m_SwapchainDirty = true;
+}
+
+void VkRenderer::SetTime(double totalTime, double deltaTime)
+{
+	m_TotalTime = totalTime;
+	m_DeltaTime = deltaTime;
+}
+
+void VkRenderer::RecreateSwapchain()
+{
+	// Wait until the window has a size again
+	auto width = 0, height = 0;
+	SDL_Vulkan_GetDrawableSize(m_Window, &width, &height);
+	if (width == 0 || height == 0)
+	{
+		return;
+	}
+
+	// Everything that still references the old images is retired, not destroyed, so in flight frames keep running
+	m_DeletionQueue.Retire(m_VkCommandPool, std::move(m_CommandBuffers));
+	for (auto imageView : m_SwapChainImageViews)
+	{
+		m_DeletionQueue.Retire(imageView);
+	}
+
+	// The old swapchain is still passed as oldSwapchain, it is only destroyed once its frames finished
+	auto oldSwapchain = m_VkSwapchainKHR;
+	auto oldFormat = m_Format.format;
+
+	m_CommandBuffers.clear();
+	m_SwapChainImageViews.clear();
+
+	CreateSwapchain();
+	CreateImageViews();
+	m_DeletionQueue.Retire(oldSwapchain);
+
+	// Static buffers use the image index as their frame slot, a swapchain with more images needs more slots
+	auto frameSlots = std::max((uint32_t)m_SwapChainImages.size(), m_FramesInFlight);
+	if (frameSlots > m_UniformRing.RegionCount())
+	{
+		// Rare enough to simply drain the queue, the ring's set is rewritten in place
+		m_Timeline.Wait(m_Timeline.Submitted());
+		m_UniformRing.Resize(frameSlots);
+		m_DescriptorArena.Resize(frameSlots);
+		m_GpuProfiler.Destroy();
+		m_GpuProfiler.Create(m_VkPhysicalDevice, m_VkDevice, m_GraphicsFamily.value(), frameSlots);
+		m_ProfilerSlots.assign(m_FramesInFlight, UINT32_MAX);
+	}
+
+	// Pipelines only depend on the render passes, so the graph is only built again when the format changed
+	if (m_Format.format != oldFormat)
+	{
+		BuildRenderGraph();
+	}
+	else
+	{
+		m_RenderGraph.SetImportedImages(m_Backbuffer, m_SwapChainImages, m_SwapChainImageViews);
+		m_RenderGraph.Resize(m_Extent);
+
+		if (m_OcclusionCulling)
+		{
+			m_Culling.SetDepth(m_RenderGraph.View(m_DepthTarget), m_Extent);
+		}
+	}
+
+	if (m_Settings.Recording == RecordMode::Static)
+	{
+		CreateCommandBuffers();
+	}
+
+	m_ImageValues.assign(m_SwapChainImages.size(), 0);
+	m_SwapchainDirty = false;
+}
+
 void VkRenderer::CreateImageViews()
 {
 	m_SwapChainImageViews.resize(m_SwapChainImages.size());
@@ -470,226 +1151,201 @@ void VkRenderer::CreateImageViews()
 	}
 }
 
-void VkRenderer::CreateGraphicsPipeline()
+void VkRenderer::ChooseRenderTargetFormats()
 {
-	// Load SPIR_V
-	auto vertShaderCode = Vk::readFile("shaders/vert.spv");
-	auto fragShaderCode = Vk::readFile("shaders/frag.spv");
-
-	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
-
-	// Pipeline
-	VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
-	vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-	vertShaderStageInfo.module = vertShaderModule;
-	vertShaderStageInfo.pName = "main";
-
-	VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
-	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-	fragShaderStageInfo.module = fragShaderModule;
-	fragShaderStageInfo.pName = "main";
-
-	VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
-
-	// Vertex input
-	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
-	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 0;
-	vertexInputInfo.pVertexBindingDescriptions = nullptr; // Optional
-	vertexInputInfo.vertexAttributeDescriptionCount = 0;
-	vertexInputInfo.pVertexAttributeDescriptions = nullptr; // Optional
-
-	// Input assembler
-	VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
-	inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-	inputAssembly.primitiveRestartEnable = VK_FALSE;
-
-	// Viewport
-	VkViewport viewport{};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)m_Extent.width;
-	viewport.height = (float)m_Extent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(m_VkPhysicalDevice, &properties);
 
-	VkRect2D scissor{};
-	scissor.offset = { 0, 0 };
-	scissor.extent = m_Extent;
+	// The highest supported count that does not exceed the requested one
+	auto supportedSamples = properties.limits.framebufferColorSampleCounts;
+	if (m_Settings.Depth)
+	{
+		supportedSamples &= properties.limits.framebufferDepthSampleCounts;
+	}
 
-	VkPipelineViewportStateCreateInfo viewportState{};
-	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
-	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
-
-	// Rasterizer
-	VkPipelineRasterizationStateCreateInfo rasterizer{};
-	rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-	rasterizer.depthClampEnable = VK_FALSE;
-	rasterizer.rasterizerDiscardEnable = VK_FALSE;
-	rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-	rasterizer.lineWidth = 1.0f;
-	rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-	rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-	rasterizer.depthBiasEnable = VK_FALSE;
-	rasterizer.depthBiasConstantFactor = 0.0f; // Optional
-	rasterizer.depthBiasClamp = 0.0f; // Optional
-	rasterizer.depthBiasSlopeFactor = 0.0f; // Optional
-
-	// Multisampling???
-	VkPipelineMultisampleStateCreateInfo multisampling{};
-	multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-	multisampling.sampleShadingEnable = VK_FALSE;
-	multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-	multisampling.minSampleShading = 1.0f; // Optional
-	multisampling.pSampleMask = nullptr; // Optional
-	multisampling.alphaToCoverageEnable = VK_FALSE; // Optional
-	multisampling.alphaToOneEnable = VK_FALSE; // Optional
-
-	// Color blending
-	VkPipelineColorBlendAttachmentState colorBlendAttachment{};
-	colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-	colorBlendAttachment.blendEnable = VK_FALSE;
-	colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-	colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-	colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD; // Optional
-	colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE; // Optional
-	colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO; // Optional
-	colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD; // Optional
-
-	// ???
-	VkPipelineColorBlendStateCreateInfo colorBlending{};
-	colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-	colorBlending.logicOpEnable = VK_FALSE;
-	colorBlending.logicOp = VK_LOGIC_OP_COPY; // Optional
-	colorBlending.attachmentCount = 1;
-	colorBlending.pAttachments = &colorBlendAttachment;
-	colorBlending.blendConstants[0] = 0.0f; // Optional
-	colorBlending.blendConstants[1] = 0.0f; // Optional
-	colorBlending.blendConstants[2] = 0.0f; // Optional
-	colorBlending.blendConstants[3] = 0.0f; // Optional
-
-	// Dynamic state
-	VkDynamicState dynamicStates[] = {
-		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
-	};
+	m_Samples = VK_SAMPLE_COUNT_1_BIT;
+	for (uint32_t samples = 64; samples > 1; samples /= 2)
+	{
+		if (samples <= m_Settings.Samples && (supportedSamples & samples))
+		{
+			m_Samples = (VkSampleCountFlagBits)samples;
+			break;
+		}
+	}
 
-	VkPipelineDynamicStateCreateInfo dynamicState{};
-	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-	dynamicState.dynamicStateCount = 2;
-	dynamicState.pDynamicStates = dynamicStates;
+	// Occlusion culling samples depth, formats without stencil so a single view serves as attachment and texture.
+	// D16 always supports both
+	m_DepthFormat = VK_FORMAT_UNDEFINED;
+	m_OcclusionCulling = false;
+	if (m_Settings.Depth && IsCulling() && (properties.limits.sampledImageDepthSampleCounts & m_Samples))
+	{
+		for (auto format : { VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM })
+		{
+			VkFormatProperties formatProperties;
+			vkGetPhysicalDeviceFormatProperties(m_VkPhysicalDevice, format, &formatProperties);
+			auto required = VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+			if ((formatProperties.optimalTilingFeatures & required) == required)
+			{
+				m_DepthFormat = format;
+				m_OcclusionCulling = true;
+				break;
+			}
+		}
+	}
+
+	// Otherwise packed depth stencil formats first, the stencil is never stored so it costs nothing
+	if (m_Settings.Depth && m_DepthFormat == VK_FORMAT_UNDEFINED)
+	{
+		for (auto format : { VK_FORMAT_D32_SFLOAT_S8_UINT, VK_FORMAT_D24_UNORM_S8_UINT, VK_FORMAT_D32_SFLOAT })
+		{
+			VkFormatProperties formatProperties;
+			vkGetPhysicalDeviceFormatProperties(m_VkPhysicalDevice, format, &formatProperties);
+			if (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)
+			{
+				m_DepthFormat = format;
+				break;
+			}
+		}
+
+		if (m_DepthFormat == VK_FORMAT_UNDEFINED)
+		{
+			std::cout << "No depth format supported, rendering without depth\n";
+		}
+	}
+
+	std::cout << "Render targets: " << m_Samples << "x MSAA, " << (m_DepthFormat != VK_FORMAT_UNDEFINED ? "depth" : "no depth") << '\n';
+	if (IsCulling())
+	{
+		std::cout << "GPU culling: frustum" << (m_OcclusionCulling ? " and Hi-Z occlusion" : " only") << '\n';
+	}
+}
 
+void VkRenderer::CreateGraphicsPipeline()
+{
 	// Pipeline layout
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 0; // Optional
-	pipelineLayoutInfo.pSetLayouts = nullptr; // Optional
-	pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-	pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+	// Everything the shaders read goes through the bindless set, the push constants select the slots.
+	// Per frame data comes from the uniform ring
+	VkDescriptorSetLayout setLayouts[] = { m_Bindless.Layout(), m_UniformRing.Layout() };
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DrawConstants);
+
+	pipelineLayoutInfo.setLayoutCount = 2;
+	pipelineLayoutInfo.pSetLayouts = setLayouts;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
 	Vk::Check(vkCreatePipelineLayout(m_VkDevice, &pipelineLayoutInfo, nullptr, &m_PipelineLayout));
 
-	// Create pipeline
-	VkGraphicsPipelineCreateInfo pipelineInfo{};
-	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-	pipelineInfo.stageCount = 2;
-	pipelineInfo.pStages = shaderStages;
-
-	pipelineInfo.pVertexInputState = &vertexInputInfo;
-	pipelineInfo.pInputAssemblyState = &inputAssembly;
-	pipelineInfo.pViewportState = &viewportState;
-	pipelineInfo.pRasterizationState = &rasterizer;
-	pipelineInfo.pMultisampleState = &multisampling;
-	pipelineInfo.pDepthStencilState = nullptr; // Optional
-	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr; // Optional
-	pipelineInfo.layout = m_PipelineLayout;
-	pipelineInfo.renderPass = m_RenderPass;
-	pipelineInfo.subpass = 0;
-	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
-	pipelineInfo.basePipelineIndex = -1; // Optional
+	// Variants stand in for materials, each combination of culling, blending and write mask is its own pipeline
+	auto variantCount = std::max(1u, m_Settings.PipelineVariants);
+	for (uint32_t i = 0; i < variantCount; i++)
+	{
+		PipelineDesc desc;
+		desc.CullMode = (i & 1) ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
+		desc.Blend = (i & 2) != 0;
+		desc.ColorWriteMask &= ~((i >> 2) & 0x7);
+		desc.DepthTest = m_DepthFormat != VK_FORMAT_UNDEFINED;
+		desc.DepthWrite = desc.DepthTest;
+		m_PipelineVariants.push_back(m_PipelineLibrary.Add(desc));
+	}
 
-	Vk::Check(vkCreateGraphicsPipelines(m_VkDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_VkPipeline));
+	std::cout << "Pipelines: " << m_PipelineLibrary.VariantCount() << " variants in " << m_PipelineLibrary.PipelineCount() << " pipelines";
+	std::cout << (m_ExtendedDynamicState ? " (extended dynamic state)" : "") << '\n';
 
-	// Cleanup at the end
-	vkDestroyShaderModule(m_VkDevice, fragShaderModule, nullptr);
-	vkDestroyShaderModule(m_VkDevice, vertShaderModule, nullptr);
+	// The plain variant is compiled as soon as the render graph sets the target, the rest on the library threads
+	m_PipelineLibrary.SetFallback(m_PipelineVariants[0]);
 }
 
-VkShaderModule VkRenderer::createShaderModule(const std::vector<char>& code)
+void VkRenderer::SetViewport(VkCommandBuffer commandBuffer)
 {
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+	// Viewport and scissor are dynamic, a resize never touches the pipelines
+	VkViewport viewport{};
+	viewport.x = 0.0f;
+	viewport.y = 0.0f;
+	viewport.width = (float)m_Extent.width;
+	viewport.height = (float)m_Extent.height;
+	viewport.minDepth = 0.0f;
+	viewport.maxDepth = 1.0f;
 
-	VkShaderModule shaderModule;
-	Vk::Check(vkCreateShaderModule(m_VkDevice, &createInfo, nullptr, &shaderModule));
-	return shaderModule;
+	VkRect2D scissor{};
+	scissor.offset = { 0, 0 };
+	scissor.extent = m_Extent;
+
+	vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+	vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
 }
 
-void VkRenderer::CreateRenderPass()
+void VkRenderer::BuildRenderGraph()
 {
-	// Attachment description
-	VkAttachmentDescription colorAttachment{};
-	colorAttachment.format = m_Format.format;
-	colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-	colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-	colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-	colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-	colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-	// Subpasses and attachment references
-	VkAttachmentReference colorAttachmentRef{};
-	colorAttachmentRef.attachment = 0;
-	colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	m_RenderGraph.Reset();
+
+	// The acquire semaphore is waited on at color output, offscreen images are only waited on by the host
+	auto finalLayout = IsHeadless() ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	VkPipelineStageFlags waitStages = IsHeadless() ? 0 : VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+	m_Backbuffer = m_RenderGraph.ImportImage("Backbuffer", m_Format.format, finalLayout, waitStages);
+	m_RenderGraph.SetImportedImages(m_Backbuffer, m_SwapChainImages, m_SwapChainImageViews);
+
+	// Culling runs ahead of the draws that consume its output, and after the previous frame's draws
+	uint32_t indirect = 0;
+	uint32_t instances = 0;
+	if (IsCulling())
+	{
+		indirect = m_RenderGraph.ImportBuffer("Indirect", m_IndirectBuffer);
+		instances = m_RenderGraph.ImportBuffer("CulledInstances", m_Culling.Output());
 
-	VkSubpassDescription subpass{};
-	subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-	subpass.colorAttachmentCount = 1;
-	subpass.pColorAttachments = &colorAttachmentRef;
+		auto cullPass = m_RenderGraph.AddPass("Cull", [this](VkCommandBuffer commandBuffer, uint32_t) { m_Culling.Record(commandBuffer, m_Frustum); });
+		m_RenderGraph.WriteBuffer(cullPass, indirect, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		m_RenderGraph.WriteBuffer(cullPass, instances, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT);
+	}
 
-	// Render pass
-	VkRenderPassCreateInfo renderPassInfo{};
-	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-	renderPassInfo.attachmentCount = 1;
-	renderPassInfo.pAttachments = &colorAttachment;
-	renderPassInfo.subpassCount = 1;
-	renderPassInfo.pSubpasses = &subpass;
+	m_ScenePass = m_RenderGraph.AddPass("Scene", [this](VkCommandBuffer commandBuffer, uint32_t imageIndex) { RecordScene(commandBuffer, imageIndex); });
+	if (IsCulling())
+	{
+		m_RenderGraph.ReadBuffer(m_ScenePass, indirect, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+		m_RenderGraph.ReadBuffer(m_ScenePass, instances, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+	}
 
-	Vk::Check(vkCreateRenderPass(m_VkDevice, &renderPassInfo, nullptr, &m_RenderPass));
-}
+	// With MSAA the scene renders into a transient target that resolves into the backbuffer
+	if (m_Samples != VK_SAMPLE_COUNT_1_BIT)
+	{
+		auto color = m_RenderGraph.CreateImage("Color", m_Format.format, m_Samples);
+		m_RenderGraph.ColorAttachment(m_ScenePass, color, true);
+		m_RenderGraph.ResolveAttachment(m_ScenePass, m_Backbuffer);
+	}
+	else
+	{
+		m_RenderGraph.ColorAttachment(m_ScenePass, m_Backbuffer, true);
+	}
 
-void VkRenderer::CreateFramebuffers()
-{
-	m_SwapChainFramebuffers.resize(m_SwapChainImageViews.size());
+	if (m_DepthFormat != VK_FORMAT_UNDEFINED)
+	{
+		m_DepthTarget = m_RenderGraph.CreateImage("Depth", m_DepthFormat, m_Samples);
+		m_RenderGraph.DepthAttachment(m_ScenePass, m_DepthTarget, true);
+	}
 
-	for (size_t i = 0; i < m_SwapChainImageViews.size(); i++) 
+	// The depth of this frame becomes the occlusion pyramid the next frame culls against
+	if (m_OcclusionCulling)
 	{
-		VkImageView attachments[] = {
-			m_SwapChainImageViews[i]
-		};
+		auto pyramidPass = m_RenderGraph.AddPass("DepthPyramid", [this](VkCommandBuffer commandBuffer, uint32_t) { m_Culling.RecordPyramid(commandBuffer); });
+		m_RenderGraph.ReadImage(pyramidPass, m_DepthTarget, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+		m_RenderGraph.SetSideEffects(pyramidPass, true);
+	}
 
-		VkFramebufferCreateInfo framebufferInfo{};
-		framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-		framebufferInfo.renderPass = m_RenderPass;
-		framebufferInfo.attachmentCount = 1;
-		framebufferInfo.pAttachments = attachments;
-		framebufferInfo.width = m_Extent.width;
-		framebufferInfo.height = m_Extent.height;
-		framebufferInfo.layers = 1;
+	m_RenderGraph.SetSecondary(m_ScenePass, m_Settings.Recording == RecordMode::Parallel);
+	m_RenderGraph.Compile(m_Extent);
 
-		Vk::Check(vkCreateFramebuffer(m_VkDevice, &framebufferInfo, nullptr, &m_SwapChainFramebuffers[i]));
+	if (m_OcclusionCulling)
+	{
+		m_Culling.SetDepth(m_RenderGraph.View(m_DepthTarget), m_Extent);
 	}
+
+	// Pipelines are built against the scene pass, the library retires the old ones
+	m_PipelineLibrary.SetTarget(m_RenderGraph.RenderPass(m_ScenePass), m_PipelineLayout, m_Samples);
 }
 
 void VkRenderer::CreateCommandPool()
@@ -702,10 +1358,107 @@ void VkRenderer::CreateCommandPool()
 	Vk::Check(vkCreateCommandPool(m_VkDevice, &poolInfo, nullptr, &m_VkCommandPool));
 }
 
+void VkRenderer::CreateScene()
+{
+	auto mesh = m_Settings.MeshTriangles > 0 ? Mesh::CreateGrid(m_Settings.MeshTriangles) : Mesh::CreateTriangle();
+
+	// Vertex buffer
+	auto vertexSize = sizeof(Vertex) * mesh.Vertices.size();
+	m_VertexBuffer = CreateDeviceBuffer(vertexSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, mesh.Vertices.data(), m_VertexAllocation);
+
+	// Index buffer, 16 bit indices halve the index fetch bandwidth when they are enough
+	if (mesh.Vertices.size() <= UINT16_MAX)
+	{
+		std::vector<uint16_t> indices(mesh.Indices.begin(), mesh.Indices.end());
+		m_IndexType = VK_INDEX_TYPE_UINT16;
+		m_IndexBuffer = CreateDeviceBuffer(sizeof(uint16_t) * indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indices.data(), m_IndexAllocation);
+	}
+	else
+	{
+		m_IndexType = VK_INDEX_TYPE_UINT32;
+		m_IndexBuffer = CreateDeviceBuffer(sizeof(uint32_t) * mesh.Indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, mesh.Indices.data(), m_IndexAllocation);
+	}
+
+	// One instance per object, direct draws pick theirs with firstInstance
+	auto objectCount = std::max(1u, m_Settings.DrawCount);
+	auto instances = Mesh::CreateInstanceGrid(objectCount);
+	m_InstanceBuffer = CreateDeviceBuffer(sizeof(InstanceData) * instances.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, instances.data(), m_InstanceAllocation);
+
+	if (m_Settings.Indirect)
+	{
+		// Every object is an instance of the same mesh, so one command draws the whole scene
+		VkDrawIndexedIndirectCommand command{};
+		command.indexCount = (uint32_t)mesh.Indices.size();
+		command.instanceCount = objectCount;
+		command.firstIndex = 0;
+		command.vertexOffset = 0;
+		command.firstInstance = 0;
+
+		m_IndirectDrawCount = 1;
+		m_IndirectBuffer = CreateDeviceBuffer(sizeof(command), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &command, m_IndirectAllocation);
+		m_DrawCountBuffer = CreateDeviceBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &m_IndirectDrawCount, m_DrawCountAllocation);
+
+		if (IsCulling())
+		{
+			// Bounds in the same space as the instance offsets
+			auto radius = Mesh::BoundingRadius(mesh);
+			std::vector<BoundingSphere> bounds(objectCount);
+			for (uint32_t i = 0; i < objectCount; i++)
+			{
+				bounds[i] = { { instances[i].Offset[0], instances[i].Offset[1], 0.0f }, instances[i].Scale * radius };
+			}
+
+			m_Culling.Create(m_VkDevice, &m_Allocator, &m_StagingRing, &m_DescriptorArena, m_PipelineCache.Get(), &m_ShaderArchive, m_InstanceBuffer, m_IndirectBuffer,
+				bounds, m_Extent, m_OcclusionCulling, m_Samples);
+
+			// Instances only spin around their own center, which the bounding spheres already cover
+			m_Frustum = Frustum::FromViewProjection(m_ViewProjection);
+		}
+	}
+	else
+	{
+		// Repeat the mesh to give the recorder real work
+		m_DrawList.resize(objectCount);
+		for (uint32_t i = 0; i < objectCount; i++)
+		{
+			auto& draw = m_DrawList[i];
+			draw.IndexCount = (uint32_t)mesh.Indices.size();
+			draw.FirstIndex = 0;
+			draw.VertexOffset = 0;
+			draw.FirstInstance = i;
+			draw.Pipeline = m_PipelineVariants[i % m_PipelineVariants.size()];
+			draw.Spin = (i & 1 ? -1.0f : 1.0f) * (0.5f + 0.25f * (i % 5));
+			draw.Texture = m_SceneTextures.empty() ? TextureStreamer::NONE : m_SceneTextures[i % m_SceneTextures.size()];
+		}
+	}
+
+	// Culling compacts the visible instances into its own buffer, the shaders read that one instead
+	m_InstanceSlot = m_Bindless.AddBuffer(IsCulling() ? m_Culling.Output() : m_InstanceBuffer);
+
+	// Submitted ahead of the first frame on the same queue, the ring barrier orders them
+	m_StagingRing.Flush();
+}
+
+VkBuffer VkRenderer::CreateDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, const void* data, GpuAllocation& allocation)
+{
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+	auto buffer = m_Allocator.CreateBuffer(bufferInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, allocation);
+	m_StagingRing.Upload(buffer, 0, data, size);
+	return buffer;
+}
+
 void VkRenderer::CreateCommandBuffers()
 {
+	// Recorded once, so they must not capture a fallback pipeline
+	m_PipelineLibrary.WaitIdle();
+
 	// Create buffer
-	m_CommandBuffers.resize(m_SwapChainFramebuffers.size());
+	m_CommandBuffers.resize(m_SwapChainImages.size());
 
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -718,32 +1471,266 @@ void VkRenderer::CreateCommandBuffers()
 	// Record command buffer
 	for (size_t i = 0; i < m_CommandBuffers.size(); i++)
 	{
-		VkCommandBufferBeginInfo beginInfo{};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0; // Optional
-		beginInfo.pInheritanceInfo = nullptr; // Optional
+		RecordCommandBuffer(m_CommandBuffers[i], (uint32_t)i, 0);
+	}
+}
+
+void VkRenderer::RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkCommandBufferUsageFlags flags)
+{
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = flags;
+	beginInfo.pInheritanceInfo = nullptr; // Optional
+
+	Vk::Check(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+	auto slot = FrameSlot(imageIndex);
+	m_GpuProfiler.BeginFrame(commandBuffer, slot);
+	m_DescriptorArena.BeginFrame(slot);
+
+	// Barriers, layout transitions and render passes all come from the graph
+	m_RenderGraph.Execute(commandBuffer, imageIndex, &m_GpuProfiler, slot);
+
+	Vk::Check(vkEndCommandBuffer(commandBuffer));
+}
+
+void VkRenderer::RecordScene(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	if (m_Settings.Recording == RecordMode::Parallel)
+	{
+		// Only vkCmdExecuteCommands is allowed inside a secondary subpass, so there is no separate draw scope here
+		vkCmdExecuteCommands(commandBuffer, (uint32_t)m_SecondaryBuffers.size(), m_SecondaryBuffers.data());
+		return;
+	}
+
+	SetViewport(commandBuffer);
+	BindScene(commandBuffer, imageIndex);
+
+	auto slot = FrameSlot(imageIndex);
+	auto drawScope = m_GpuProfiler.BeginScope(commandBuffer, slot, "Draw");
+	PipelineBinding binding;
+	if (m_Settings.Indirect)
+	{
+		m_PipelineLibrary.Bind(commandBuffer, m_PipelineVariants[0], binding);
+		RecordIndirectDraws(commandBuffer);
+	}
+	else
+	{
+		// Variants still compiling resolve to the fallback, Bind skips whatever did not change
+		for (const auto& draw : m_DrawList)
+		{
+			m_PipelineLibrary.Bind(commandBuffer, draw.Pipeline, binding);
+			PushDraw(commandBuffer, draw);
+			vkCmdDrawIndexed(commandBuffer, draw.IndexCount, 1, draw.FirstIndex, draw.VertexOffset, draw.FirstInstance);
+		}
+	}
+	m_GpuProfiler.EndScope(commandBuffer, slot, drawScope);
+}
+
+void VkRenderer::CreateFrameCommandPools()
+{
+	if (m_Settings.Recording == RecordMode::Parallel)
+	{
+		m_JobSystem = std::make_unique<JobSystem>(m_Settings.WorkerCount);
+	}
+
+	// Pools are reset as a whole every frame, never buffer by buffer
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = m_GraphicsFamily.value();
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+
+	m_FrameCommands.resize(m_FramesInFlight);
+	for (auto& frame : m_FrameCommands)
+	{
+		Vk::Check(vkCreateCommandPool(m_VkDevice, &poolInfo, nullptr, &frame.Pool));
+
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = frame.Pool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		Vk::Check(vkAllocateCommandBuffers(m_VkDevice, &allocInfo, &frame.Primary));
+
+		// A pool may only be used from one thread at a time, so every worker gets its own
+		if (m_JobSystem)
+		{
+			frame.Workers.resize(m_JobSystem->WorkerCount());
+			for (auto& worker : frame.Workers)
+			{
+				Vk::Check(vkCreateCommandPool(m_VkDevice, &poolInfo, nullptr, &worker.Pool));
+			}
+		}
+	}
+}
+
+VkCommandBuffer VkRenderer::RecordFrame(uint32_t imageIndex)
+{
+	Timer timer;
+	timer.Start();
+
+	auto& frame = m_FrameCommands[currentFrame];
+
+	// The timeline passed this frame's last submission, nothing allocated from these pools is still executing
+	Vk::Check(vkResetCommandPool(m_VkDevice, frame.Pool, 0));
+	for (auto& worker : frame.Workers)
+	{
+		Vk::Check(vkResetCommandPool(m_VkDevice, worker.Pool, 0));
+		worker.Used = 0;
+	}
+
+	if (m_Settings.Recording == RecordMode::Parallel)
+	{
+		// Split the draw list into one contiguous range per job
+		auto drawCount = (uint32_t)m_DrawList.size();
+		auto jobCount = std::min(m_JobSystem->WorkerCount(), drawCount);
+		auto drawsPerJob = (drawCount + jobCount - 1) / jobCount;
+
+		m_SecondaryBuffers.resize(jobCount);
+		m_JobSystem->Dispatch(jobCount, [&](uint32_t job, uint32_t worker)
+		{
+			auto firstDraw = job * drawsPerJob;
+			auto count = std::min(drawsPerJob, drawCount - std::min(drawCount, firstDraw));
+			m_SecondaryBuffers[job] = RecordSecondary(worker, imageIndex, firstDraw, count);
+		});
+	}
+
+	RecordCommandBuffer(frame.Primary, imageIndex, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+
+	timer.Tick();
+	m_RecordTime += timer.TotalTime();
+	return frame.Primary;
+}
+
+VkCommandBuffer VkRenderer::RecordSecondary(uint32_t worker, uint32_t imageIndex, uint32_t firstDraw, uint32_t drawCount)
+{
+	auto& commands = m_FrameCommands[currentFrame].Workers[worker];
+
+	// Buffers survive the pool reset, only allocate when a worker ran more jobs than ever before
+	if (commands.Used == commands.Secondaries.size())
+	{
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = commands.Pool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = 1;
+
+		VkCommandBuffer commandBuffer;
+		Vk::Check(vkAllocateCommandBuffers(m_VkDevice, &allocInfo, &commandBuffer));
+		commands.Secondaries.push_back(commandBuffer);
+	}
+
+	auto commandBuffer = commands.Secondaries[commands.Used++];
+
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = m_RenderGraph.RenderPass(m_ScenePass);
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = m_RenderGraph.Framebuffer(m_ScenePass, imageIndex);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	Vk::Check(vkBeginCommandBuffer(commandBuffer, &beginInfo));
+
+	// Secondaries inherit no dynamic state from the primary
+	SetViewport(commandBuffer);
+	BindScene(commandBuffer, imageIndex);
+
+	PipelineBinding binding;
+	for (uint32_t i = firstDraw; i < firstDraw + drawCount; i++)
+	{
+		const auto& draw = m_DrawList[i];
+		m_PipelineLibrary.Bind(commandBuffer, draw.Pipeline, binding);
+		PushDraw(commandBuffer, draw);
+		vkCmdDrawIndexed(commandBuffer, draw.IndexCount, 1, draw.FirstIndex, draw.VertexOffset, draw.FirstInstance);
+	}
 
-		Vk::Check(vkBeginCommandBuffer(m_CommandBuffers[i], &beginInfo));
+	Vk::Check(vkEndCommandBuffer(commandBuffer));
+	return commandBuffer;
+}
+
+void VkRenderer::BindScene(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &m_VertexBuffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, m_IndexBuffer, 0, m_IndexType);
+
+	// The frame uniforms are the first block of the frame's region, static command buffers bake the same offset
+	VkDescriptorSet sets[] = { m_Bindless.Set(), m_UniformRing.Set() };
+	auto frameOffset = m_UniformRing.RegionOffset(FrameSlot(imageIndex));
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_PipelineLayout, 0, 2, sets, 1, &frameOffset);
+
+	DrawConstants constants{};
+	constants.InstanceBuffer = m_InstanceSlot;
+	constants.Spin = 1.0f;
+	constants.Texture = m_TextureStreamer.BindlessIndex(m_SceneTextures.empty() ? TextureStreamer::NONE : m_SceneTextures[0]);
+	vkCmdPushConstants(commandBuffer, m_PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(constants), &constants);
+}
 
-		// Render pass
-		VkRenderPassBeginInfo renderPassInfo{};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = m_RenderPass;
-		renderPassInfo.framebuffer = m_SwapChainFramebuffers[i];
-		renderPassInfo.renderArea.offset = { 0, 0 };
-		renderPassInfo.renderArea.extent = m_Extent;
+void VkRenderer::PushDraw(VkCommandBuffer commandBuffer, const DrawItem& draw)
+{
+	// Only the per draw part of the constants, the rest stays as BindScene pushed it
+	struct
+	{
+		float Spin;
+		uint32_t Texture;
+	} constants = { draw.Spin, m_TextureStreamer.BindlessIndex(draw.Texture) };
 
-		VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
-		renderPassInfo.clearValueCount = 1;
-		renderPassInfo.pClearValues = &clearColor;
+	vkCmdPushConstants(commandBuffer, m_PipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, offsetof(DrawConstants, Spin), sizeof(constants), &constants);
+}
 
-		vkCmdBeginRenderPass(m_CommandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+void VkRenderer::StreamTextures()
+{
+	// Right before recording, so the uploads always go out with this frame's staging batch
+	for (auto texture : m_SceneTextures)
+	{
+		m_TextureStreamer.Touch(texture);
+	}
 
-		// Bind to pipeline
-		vkCmdBindPipeline(m_CommandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m_VkPipeline);
-		vkCmdDraw(m_CommandBuffers[i], 3, 1, 0, 0);
-		vkCmdEndRenderPass(m_CommandBuffers[i]);
+	m_TextureStreamer.Update();
+}
 
-		Vk::Check(vkEndCommandBuffer(m_CommandBuffers[i]));
+void VkRenderer::UpdateFrameUniforms(uint32_t imageIndex)
+{
+	// The region's last reader was the submission just waited for
+	m_UniformRing.BeginFrame(FrameSlot(imageIndex));
+
+	FrameUniforms uniforms{};
+	std::memcpy(uniforms.Transform, m_ViewProjection, sizeof(uniforms.Transform));
+	uniforms.Time[0] = (float)m_TotalTime;
+	uniforms.Time[1] = (float)m_DeltaTime;
+	uniforms.Time[2] = (float)m_FrameNumber++;
+	m_UniformRing.Push(uniforms);
+}
+
+void VkRenderer::RecordIndirectDraws(VkCommandBuffer commandBuffer)
+{
+	auto stride = (uint32_t)sizeof(VkDrawIndexedIndirectCommand);
+
+	// Culling only writes the instanceCount of the commands, the count buffer holds the command count written at creation
+	if (m_vkCmdDrawIndexedIndirectCount != nullptr)
+	{
+		m_vkCmdDrawIndexedIndirectCount(commandBuffer, m_IndirectBuffer, 0, m_DrawCountBuffer, 0, m_IndirectDrawCount, stride);
+	}
+	else if (m_EnabledFeatures.multiDrawIndirect || m_IndirectDrawCount <= 1)
+	{
+		vkCmdDrawIndexedIndirect(commandBuffer, m_IndirectBuffer, 0, m_IndirectDrawCount, stride);
 	}
+	else
+	{
+		for (uint32_t i = 0; i < m_IndirectDrawCount; i++)
+		{
+			vkCmdDrawIndexedIndirect(commandBuffer, m_IndirectBuffer, (VkDeviceSize)i * stride, 1, stride);
+		}
+	}
+}
+
+uint32_t VkRenderer::FrameSlot(uint32_t imageIndex) const
+{
+	// Static buffers are per image, per frame buffers are per frame in flight
+	return m_Settings.Recording == RecordMode::Static ? imageIndex : (uint32_t)currentFrame;
 }
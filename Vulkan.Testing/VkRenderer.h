@@ -2,25 +2,166 @@
 
 #include <vector>
 #include <optional>
+#include <string>
+#include <memory>
 
 #include <SDL.h>
 #include <SDL_vulkan.h>
 #include <vulkan/vulkan.hpp>
+#include "PipelineCache.h"
+#include "GpuProfiler.h"
+#include "JobSystem.h"
+#include "GpuAllocator.h"
+#include "StagingRing.h"
+#include "Mesh.h"
+#include "GpuCulling.h"
+#include "GpuTimeline.h"
+#include "DeletionQueue.h"
+#include "PipelineLibrary.h"
+#include "ShaderManager.h"
+#include "ShaderArchive.h"
+#include "RenderGraph.h"
+#include "BindlessHeap.h"
+#include "DescriptorArena.h"
+#include "UniformRing.h"
+#include "TextureStreamer.h"
 typedef unsigned int uint;
 
+enum class RecordMode
+{
+	// Command buffers are recorded once per swapchain image at startup
+	Static,
+
+	// The main thread re-records into a transient pool per frame in flight
+	PerFrame,
+
+	// Worker threads record secondary command buffers every frame
+	Parallel,
+};
+
+enum class PresentPolicy
+{
+	// Mailbox, newest frame wins without tearing
+	LowLatency,
+
+	// Immediate, no vsync at all
+	Uncapped,
+
+	// FIFO relaxed, vsync that tears instead of stuttering when a frame is late
+	Adaptive,
+
+	// FIFO, capped to the refresh rate
+	PowerSaving,
+};
+
+struct RendererSettings
+{
+	// Size of the offscreen targets when running without a window
+	uint32_t Width = 800;
+	uint32_t Height = 600;
+
+	// Pipeline cache blob loaded at startup and written back at shutdown
+	std::string PipelineCachePath = "pipeline_cache.bin";
+
+	// Index or part of the name of the GPU to use, falls back to VKTEST_DEVICE and then to the highest score
+	std::string Device;
+
+	// Use a transfer-only queue family for uploads when the device has one
+	bool DedicatedQueues = true;
+
+	// Set cull mode, topology and depth state while recording when VK_EXT_extended_dynamic_state is there
+	bool ExtendedDynamicState = true;
+
+	// Frame pacing, falls back towards FIFO when the preferred mode is not supported
+	PresentPolicy Pacing = PresentPolicy::PowerSaving;
+	uint32_t FramesInFlight = 2;
+
+	// Depth buffer and MSAA sample count, clamped to what the device supports
+	bool Depth = true;
+	uint32_t Samples = 1;
+
+	// Command recording
+	RecordMode Recording = RecordMode::Static;
+	uint32_t WorkerCount = 0;
+
+	// Number of objects in the scene, each one its own draw call unless Indirect is set
+	uint32_t DrawCount = 1;
+
+	// Draws every object as an instance of one indirect draw, the CPU cost no longer grows with DrawCount
+	bool Indirect = false;
+
+	// Frustum and occlusion culling in a compute pass ahead of the indirect draws
+	bool Culling = true;
+
+	// Zero draws the single triangle, otherwise a grid of about this many triangles
+	uint32_t MeshTriangles = 0;
+
+	// Pipeline variants the direct draws cycle through, all but the first one compile in the background
+	uint32_t PipelineVariants = 1;
+
+	// Recompiles edited GLSL sources and swaps the pipelines that use them, needs per frame recording
+	bool HotReload = false;
+	std::string ShaderSourcePath = "Shaders";
+
+	// Packed SPIR-V from --pack-shaders, shaders missing from it are loaded from loose .spv files
+	std::string ShaderArchivePath = "shaders/shaders.spva";
+
+	// KTX2 files streamed in the background and spread over the draws, the budget in MiB bounds their full mip chains
+	std::vector<std::string> Textures;
+	uint32_t TextureBudget = 256;
+};
+
+struct DrawItem
+{
+	uint32_t IndexCount;
+	uint32_t FirstIndex;
+	int32_t VertexOffset;
+	uint32_t FirstInstance;
+	uint32_t Pipeline;
+	float Spin;
+	uint32_t Texture;
+};
+
+// Pushed ahead of the draws, the indices point into the bindless heap. Direct draws push their own Spin and Texture
+struct DrawConstants
+{
+	uint32_t InstanceBuffer;
+	float Spin;
+	uint32_t Texture;
+};
+
+// Written once per frame into the uniform ring, std140 layout
+struct FrameUniforms
+{
+	float Transform[16];
+
+	// Total time, delta time and frame number
+	float Time[4];
+};
+
 class VkRenderer
 {
 public:
-	VkRenderer(SDL_Window* window);
+	// Passing a null window creates a headless renderer that draws into offscreen images
+	VkRenderer(SDL_Window* window, const RendererSettings& settings = RendererSettings());
 	virtual ~VkRenderer();
 
 	bool Create();
+	constexpr bool IsHeadless() const { return m_Window == nullptr; }
 
 	void createSyncObjects();
 	void DrawFrame();
+	void DrawFrameHeadless();
+
+	// Marks the swapchain for recreation before the next frame
+	void OnResize();
+
+	// Timer values for the next frame's uniforms
+	void SetTime(double totalTime, double deltaTime);
 
 //private:
 	SDL_Window* m_Window = nullptr;
+	RendererSettings m_Settings;
 
 	// Validation layer
 	std::vector<const char*> m_ValidationLayers;
@@ -28,31 +169,59 @@ public:
 	// Vulkan instance
 	std::vector<const char*> m_InstanceExtensions;
 	VkInstance m_VkInstance;
-	VkSurfaceKHR m_VkSurfaceKHR;
+	VkSurfaceKHR m_VkSurfaceKHR = VK_NULL_HANDLE;
 	void CreateVkInstance();
 
 	// Vulkan physical device
 	VkPhysicalDevice m_VkPhysicalDevice;
 	std::optional<uint32_t> m_GraphicsFamily;
 	std::optional<uint32_t> m_PresentFamily;
+	std::optional<uint32_t> m_TransferFamily;
 	void PickPhysicalDevice();
+	int RateDevice(VkPhysicalDevice device);
+	bool SelectQueueFamilies(VkPhysicalDevice device);
+	static bool MatchesDevice(const std::string& requested, size_t index, const char* name);
+	static bool SupportsBindless(const VkPhysicalDeviceFeatures& features, const VkPhysicalDeviceVulkan12Features& features12);
 
 	// Vulkan device
 	VkDevice m_VkDevice;
+	VkPhysicalDeviceFeatures m_EnabledFeatures{};
+	PFN_vkCmdDrawIndexedIndirectCountKHR m_vkCmdDrawIndexedIndirectCount = nullptr;
+	bool m_ExtendedDynamicState = false;
 	VkQueue graphicsQueue;
 	VkQueue m_VkPresentQueue;
+	VkQueue m_TransferQueue;
 	void CreateLogicalDevice();
 
+	// Device memory, every buffer and image is sub-allocated from here
+	GpuAllocator m_Allocator;
+
+	// Objects released while frames are in flight, destroyed once the timeline passed them
+	DeletionQueue m_DeletionQueue;
+
+	// Uploads to device local memory, on the transfer queue when there is a dedicated one
+	StagingRing m_StagingRing;
+
 	// Swapchain
 	VkSurfaceCapabilitiesKHR m_Capabilities;
 	std::vector<VkSurfaceFormatKHR> m_Formats;
 	std::vector<VkPresentModeKHR> m_PresentModes;
 	VkPresentModeKHR m_PresentMode;
+	VkPresentModeKHR ChoosePresentMode();
 	VkSurfaceFormatKHR m_Format;
-	VkSwapchainKHR m_VkSwapchainKHR;
+	VkSwapchainKHR m_VkSwapchainKHR = VK_NULL_HANDLE;
 	std::vector<VkImage> m_SwapChainImages;
 	void CreateSwapchain();
 
+	// Swapchain recreation, old objects go through the deletion queue
+	bool m_SwapchainDirty = false;
+	void RecreateSwapchain();
+
+	// Offscreen targets (headless)
+	std::vector<GpuAllocation> m_OffscreenAllocations;
+	uint32_t m_OffscreenIndex = 0;
+	void CreateOffscreenImages();
+
 	VkExtent2D m_Extent;
 
 	// Image view
@@ -60,18 +229,30 @@ public:
 	VkImageView mVkImageView;
 	void CreateImageViews();
 
+	// MSAA color and depth, created as transient images of the render graph
+	VkSampleCountFlagBits m_Samples = VK_SAMPLE_COUNT_1_BIT;
+	VkFormat m_DepthFormat = VK_FORMAT_UNDEFINED;
+	void ChooseRenderTargetFormats();
+
+	// Culling tests against a pyramid built from the depth buffer, which then has to be sampleable
+	bool m_OcclusionCulling = false;
+
 	// Pipeline
+	PipelineCache m_PipelineCache;
+	ShaderArchive m_ShaderArchive;
+	PipelineLibrary m_PipelineLibrary;
+	std::vector<uint32_t> m_PipelineVariants;
+	ShaderManager m_ShaderManager;
 	void CreateGraphicsPipeline();
-	VkShaderModule createShaderModule(const std::vector<char>& code);
-	VkRenderPass m_RenderPass;
-	VkPipelineLayout m_PipelineLayout;
-	void CreateRenderPass();
-
-	VkPipeline m_VkPipeline;
+	void SetViewport(VkCommandBuffer commandBuffer);
+	VkPipelineLayout m_PipelineLayout = VK_NULL_HANDLE;
 
-	// Framebuffers
-	std::vector<VkFramebuffer> m_SwapChainFramebuffers;
-	void CreateFramebuffers();
+	// Frame graph, owns the render passes, framebuffers and transient render targets
+	RenderGraph m_RenderGraph;
+	uint32_t m_Backbuffer = 0;
+	uint32_t m_ScenePass = 0;
+	uint32_t m_DepthTarget = 0;
+	void BuildRenderGraph();
 
 	// Command pool
 	VkCommandPool m_VkCommandPool;
@@ -81,10 +262,95 @@ public:
 	std::vector<VkCommandBuffer> m_CommandBuffers;
 	void CreateCommandBuffers();
 
+	// Scene
+	VkBuffer m_VertexBuffer = VK_NULL_HANDLE;
+	GpuAllocation m_VertexAllocation;
+	VkBuffer m_IndexBuffer = VK_NULL_HANDLE;
+	GpuAllocation m_IndexAllocation;
+	VkIndexType m_IndexType = VK_INDEX_TYPE_UINT16;
+	std::vector<DrawItem> m_DrawList;
+	void CreateScene();
+	void BindScene(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	void PushDraw(VkCommandBuffer commandBuffer, const DrawItem& draw);
+	VkBuffer CreateDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, const void* data, GpuAllocation& allocation);
+
+	// Per instance data, read by the vertex shader through the bindless heap
+	VkBuffer m_InstanceBuffer = VK_NULL_HANDLE;
+	GpuAllocation m_InstanceAllocation;
+	uint32_t m_InstanceSlot = 0;
+
+	// Descriptors, one bindless set for everything long lived and an arena per frame slot for sets written while recording
+	BindlessHeap m_Bindless;
+	DescriptorArena m_DescriptorArena;
+
+	// Per frame uniforms, bound at set 1 with a dynamic offset into the frame's region
+	UniformRing m_UniformRing;
+	double m_TotalTime = 0.0;
+	double m_DeltaTime = 0.0;
+	uint64_t m_FrameNumber = 0;
+	void UpdateFrameUniforms(uint32_t imageIndex);
+
+	// Textures of the scene, handles of the streamer that resolve to bindless indices while recording
+	TextureStreamer m_TextureStreamer;
+	std::vector<uint32_t> m_SceneTextures;
+	void StreamTextures();
+
+	// There is no camera, the scene is already in clip space. Culling builds its frustum from the same matrix
+	float m_ViewProjection[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+
+	// Indirect draws, one command per mesh with the draw count kept on the GPU as well
+	VkBuffer m_IndirectBuffer = VK_NULL_HANDLE;
+	GpuAllocation m_IndirectAllocation;
+	VkBuffer m_DrawCountBuffer = VK_NULL_HANDLE;
+	GpuAllocation m_DrawCountAllocation;
+	uint32_t m_IndirectDrawCount = 0;
+	void RecordIndirectDraws(VkCommandBuffer commandBuffer);
+
+	// GPU culling, fills the indirect buffer every frame
+	GpuCulling m_Culling;
+	Frustum m_Frustum;
+	constexpr bool IsCulling() const { return m_Settings.Indirect && m_Settings.Culling; }
+
+	// Per frame recording, every frame in flight owns its pools
+	struct WorkerCommands
+	{
+		VkCommandPool Pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> Secondaries;
+		uint32_t Used = 0;
+	};
+
+	struct FrameCommands
+	{
+		VkCommandPool Pool = VK_NULL_HANDLE;
+		VkCommandBuffer Primary = VK_NULL_HANDLE;
+		std::vector<WorkerCommands> Workers;
+	};
+
+	std::unique_ptr<JobSystem> m_JobSystem;
+	std::vector<FrameCommands> m_FrameCommands;
+	std::vector<VkCommandBuffer> m_SecondaryBuffers;
+	void CreateFrameCommandPools();
+	double m_RecordTime = 0.0;
+	VkCommandBuffer RecordFrame(uint32_t imageIndex);
+	void RecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex, VkCommandBufferUsageFlags flags);
+	void RecordScene(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	VkCommandBuffer RecordSecondary(uint32_t worker, uint32_t imageIndex, uint32_t firstDraw, uint32_t drawCount);
+
+	// GPU timestamps, one profiler slot per recorded command buffer
+	GpuProfiler m_GpuProfiler;
+	std::vector<uint32_t> m_ProfilerSlots;
+
+	// Uniform region and profiler slot of a frame, one per recorded command buffer
+	uint32_t FrameSlot(uint32_t imageIndex) const;
+
 	// Drawing?
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
-	std::vector<VkFence> inFlightFences;
-	std::vector<VkFence> imagesInFlight;
+
+	// Every graphics submission signals the next value, per slot and per image the last one that used it
+	GpuTimeline m_Timeline;
+	std::vector<uint64_t> m_FrameValues;
+	std::vector<uint64_t> m_ImageValues;
 	size_t currentFrame = 0;
+	uint32_t m_FramesInFlight = 2;
 };
\ No newline at end of file
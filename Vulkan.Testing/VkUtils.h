@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdexcept>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.hpp>
+
+namespace Vk
+{
+	inline void Check(VkResult result)
+	{
+		if (result != VkResult::VK_SUCCESS)
+		{
+			throw std::exception();
+		}
+	}
+
+	// FNV-1a, good enough to tell files apart, not meant to resist tampering
+	inline uint64_t Hash(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const uint8_t*>(data);
+		uint64_t hash = 14695981039346656037ull;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+}
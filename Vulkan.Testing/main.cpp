@@ -1,29 +1,241 @@
 #include <iostream>
 #include <string>
 #include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cmath>
 
 #include <SDL.h>
 #include "Timer.h"
+#include "FrameStats.h"
+#include "FrameLimiter.h"
 #include "VkRenderer.h"
 
 namespace
 {
-	void CalculateFPS(Timer* timer, SDL_Window* window)
+	const double STATS_INTERVAL = 1.0;
+
+	// Largest offscreen target, the limit every Vulkan device supports for 2D images
+	const uint32_t MAX_EXTENT = 4096;
+
+	void PrintUsage()
+	{
+		std::cout <<
+			"Usage: Vulkan.Testing [options]\n"
+			"  --headless                  Render offscreen without a window\n"
+			"  --width <n> --height <n>    Size of the offscreen targets, 1 to 4096\n"
+			"  --frames <n>                Frames to render headless or per benchmark run, at least 1\n"
+			"  --benchmark                 Compare the recording modes on the headless scene\n"
+			"  --instance-sweep            Compare direct and indirect draws over growing object counts\n"
+			"  --record static|frame|parallel\n"
+			"  --workers <n>               Recording threads up to 256, 0 picks one per core\n"
+			"  --present fifo|mailbox|immediate|relaxed\n"
+			"  --frames-in-flight <n>      1 to 8\n"
+			"  --fps-limit <fps>           0 leaves the frame rate uncapped\n"
+			"  --draws <n>                 Objects in the scene, at least 1\n"
+			"  --mesh-triangles <n>        0 draws a single triangle\n"
+			"  --pipeline-variants <n>     At least 1\n"
+			"  --msaa <samples>            1 to 64\n"
+			"  --texture <file.ktx2>       Stream a texture, may be given more than once\n"
+			"  --texture-budget <MiB>      At least 1\n"
+			"  --stats <file>              Write frame time summaries as CSV, or JSON lines for .json\n"
+			"  --device <index|name>       GPU to use\n"
+			"  --indirect --no-culling --no-depth --no-dedicated-queues --no-extended-dynamic-state --hot-reload\n"
+			"  --pack-shaders <archive> <spv>...\n";
+	}
+
+	// The whole argument has to be a decimal number within the range, strtoul alone would take "-1" and "12abc"
+	bool ParseNumber(const char* text, uint32_t min, uint32_t max, uint32_t& value)
+	{
+		if (!std::isdigit((unsigned char)text[0]))
+		{
+			return false;
+		}
+
+		char* end = nullptr;
+		errno = 0;
+		auto parsed = std::strtoull(text, &end, 10);
+		if (errno == ERANGE || *end != '\0' || parsed < min || parsed > max)
+		{
+			return false;
+		}
+
+		value = (uint32_t)parsed;
+		return true;
+	}
+
+	bool ParseNumber(const char* text, double min, double& value)
+	{
+		char* end = nullptr;
+		errno = 0;
+		auto parsed = std::strtod(text, &end);
+		if (end == text || errno == ERANGE || *end != '\0' || !std::isfinite(parsed) || parsed < min)
+		{
+			return false;
+		}
+
+		value = parsed;
+		return true;
+	}
+
+	void UpdateTitle(FrameStatsExporter* exporter, const GpuProfiler* profiler, SDL_Window* window, uint64_t* lastSequence)
+	{
+		FrameSummary summary;
+		if (!exporter->Latest(summary) || summary.Sequence == *lastSequence)
+		{
+			return;
+		}
+
+		*lastSequence = summary.Sequence;
+
+		char title[160];
+		std::snprintf(title, sizeof(title), "Vulkan Test - p50: %.2f ms p99: %.2f ms max: %.2f ms hitches: %u GPU: %.3f ms",
+			summary.P50, summary.P99, summary.Max, summary.Hitches, profiler->ScopeTime("Scene") * 1000.0);
+		SDL_SetWindowTitle(window, title);
+	}
+
+	int RunHeadless(const RendererSettings& settings, int frameCount, const std::string& statsPath, double fpsLimit)
+	{
+		// Only the timer is needed without a window
+		if (SDL_Init(SDL_INIT_TIMER) != 0)
+		{
+			std::cerr << "SDL_Init failed\n";
+			return -1;
+		}
+
+		VkRenderer renderer(nullptr, settings);
+		if (!renderer.Create())
+		{
+			return -1;
+		}
+
+		FrameStats stats;
+		FrameStatsExporter exporter(stats, statsPath, STATS_INTERVAL);
+		exporter.Start();
+
+		FrameLimiter limiter(fpsLimit);
+
+		Timer timer;
+		timer.Start();
+
+		for (int i = 0; i < frameCount; i++)
+		{
+			limiter.Wait();
+
+			timer.Tick();
+			stats.Push(timer.DeltaTime());
+
+			renderer.SetTime(timer.TotalTime(), timer.DeltaTime());
+			renderer.DrawFrame();
+		}
+
+		vkDeviceWaitIdle(renderer.m_VkDevice);
+		timer.Tick();
+		exporter.Stop();
+
+		auto totalTime = timer.TotalTime();
+		std::cout << "Rendered " << frameCount << " frames in " << totalTime << " s (" << frameCount / totalTime << " FPS)\n";
+
+		for (const auto& scope : renderer.m_GpuProfiler.Results())
+		{
+			std::cout << "GPU " << scope.Name << ": " << scope.Time * 1000.0 << " ms\n";
+		}
+
+		SDL_Quit();
+		return 0;
+	}
+
+	bool BenchmarkRun(RendererSettings settings, int frameCount, const char* name)
 	{
-		static double time = 0;
-		static int frameCount = 0;
+		// Every run keeps a cache of its own, with a shared one only the first run would start cold
+		settings.PipelineCachePath = std::string(name) + "_" + settings.PipelineCachePath;
+
+		VkRenderer renderer(nullptr, settings);
+		if (!renderer.Create())
+		{
+			return false;
+		}
+
+		Timer timer;
+		timer.Start();
+
+		for (int frame = 0; frame < frameCount; frame++)
+		{
+			renderer.DrawFrame();
+		}
+
+		vkDeviceWaitIdle(renderer.m_VkDevice);
+		timer.Tick();
+
+		auto frameTime = timer.TotalTime() / frameCount * 1000.0;
+		auto recordTime = renderer.m_RecordTime / frameCount * 1000.0;
+		std::printf("%-10s frame %8.4f ms  record %8.4f ms  GPU %8.4f ms\n", name, frameTime, recordTime,
+			renderer.m_GpuProfiler.ScopeTime("Scene") * 1000.0);
+		return true;
+	}
+
+	int RunBenchmark(RendererSettings settings, int frameCount)
+	{
+		if (SDL_Init(SDL_INIT_TIMER) != 0)
+		{
+			std::cerr << "SDL_Init failed\n";
+			return -1;
+		}
+
+		// Same headless scene through every recording path
+		const RecordMode modes[] = { RecordMode::Static, RecordMode::PerFrame, RecordMode::Parallel };
+		const char* names[] = { "static", "frame", "parallel" };
+
+		std::cout << "Recording benchmark: " << settings.DrawCount << " draws, " << frameCount << " frames\n";
+		for (size_t i = 0; i < 3; i++)
+		{
+			settings.Recording = modes[i];
+			if (!BenchmarkRun(settings, frameCount, names[i]))
+			{
+				return -1;
+			}
+		}
+
+		SDL_Quit();
+		return 0;
+	}
+
+	int RunInstanceSweep(RendererSettings settings, int frameCount)
+	{
+		if (SDL_Init(SDL_INIT_TIMER) != 0)
+		{
+			std::cerr << "SDL_Init failed\n";
+			return -1;
+		}
+
+		// Re-recorded every frame so the CPU cost of the draw calls shows up in the record time
+		settings.Recording = RecordMode::PerFrame;
 
-		frameCount++;
-		time += timer->DeltaTime();
-		if (time > 1.0f)
+		const uint32_t counts[] = { 1000, 10000, 100000, 1000000 };
+		for (auto count : counts)
 		{
-			auto fps = frameCount;
-			time = 0.0f;
-			frameCount = 0;
+			std::cout << "Instance sweep: " << count << " objects, " << frameCount << " frames\n";
+			settings.DrawCount = count;
 
-			auto title = "Vulkan Test - FPS: " + std::to_string(fps) + " (" + std::to_string(1000.0f / fps) + " ms)";
-			SDL_SetWindowTitle(window, title.c_str());
+			settings.Indirect = false;
+			if (!BenchmarkRun(settings, frameCount, "direct"))
+			{
+				return -1;
+			}
+
+			settings.Indirect = true;
+			if (!BenchmarkRun(settings, frameCount, "indirect"))
+			{
+				return -1;
+			}
 		}
+
+		SDL_Quit();
+		return 0;
 	}
 }
 
@@ -31,6 +243,218 @@ int main(int argc, char** argv)
 {
 	std::cout << "Vulkan Test\n";
 
+	// Command line
+	bool headless = false;
+	bool benchmark = false;
+	bool instanceSweep = false;
+	int frameCount = 1000;
+	std::string statsPath;
+	double fpsLimit = 0.0;
+	RendererSettings settings;
+
+	// Numbers are checked up front, a zero frame count or extent would otherwise only fail much later
+	auto invalid = [&](int i)
+	{
+		std::cerr << "Invalid value for " << argv[i - 1] << ": " << argv[i] << '\n';
+		PrintUsage();
+		return -1;
+	};
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (std::strcmp(argv[i], "--help") == 0)
+		{
+			PrintUsage();
+			return 0;
+		}
+		else if (std::strcmp(argv[i], "--headless") == 0)
+		{
+			headless = true;
+		}
+		else if (std::strcmp(argv[i], "--benchmark") == 0)
+		{
+			benchmark = true;
+		}
+		else if (std::strcmp(argv[i], "--instance-sweep") == 0)
+		{
+			instanceSweep = true;
+		}
+		else if (std::strcmp(argv[i], "--indirect") == 0)
+		{
+			settings.Indirect = true;
+		}
+		else if (std::strcmp(argv[i], "--no-dedicated-queues") == 0)
+		{
+			settings.DedicatedQueues = false;
+		}
+		else if (std::strcmp(argv[i], "--no-extended-dynamic-state") == 0)
+		{
+			settings.ExtendedDynamicState = false;
+		}
+		else if (std::strcmp(argv[i], "--no-depth") == 0)
+		{
+			settings.Depth = false;
+		}
+		else if (std::strcmp(argv[i], "--msaa") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 1, 64, settings.Samples))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--no-culling") == 0)
+		{
+			settings.Culling = false;
+		}
+		else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+		{
+			uint32_t frames;
+			if (!ParseNumber(argv[++i], 1, INT_MAX, frames))
+			{
+				return invalid(i);
+			}
+
+			frameCount = (int)frames;
+		}
+		else if (std::strcmp(argv[i], "--width") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 1, MAX_EXTENT, settings.Width))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--height") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 1, MAX_EXTENT, settings.Height))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+		{
+			statsPath = argv[++i];
+		}
+		else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (std::strcmp(argv[i], "parallel") == 0)
+			{
+				settings.Recording = RecordMode::Parallel;
+			}
+			else if (std::strcmp(argv[i], "frame") == 0)
+			{
+				settings.Recording = RecordMode::PerFrame;
+			}
+			else
+			{
+				settings.Recording = RecordMode::Static;
+			}
+		}
+		else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 0, 256, settings.WorkerCount))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--present") == 0 && i + 1 < argc)
+		{
+			i++;
+			if (std::strcmp(argv[i], "mailbox") == 0)
+			{
+				settings.Pacing = PresentPolicy::LowLatency;
+			}
+			else if (std::strcmp(argv[i], "immediate") == 0)
+			{
+				settings.Pacing = PresentPolicy::Uncapped;
+			}
+			else if (std::strcmp(argv[i], "relaxed") == 0)
+			{
+				settings.Pacing = PresentPolicy::Adaptive;
+			}
+			else
+			{
+				settings.Pacing = PresentPolicy::PowerSaving;
+			}
+		}
+		else if (std::strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 1, 8, settings.FramesInFlight))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--fps-limit") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 0.0, fpsLimit))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--draws") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 1, UINT32_MAX, settings.DrawCount))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--mesh-triangles") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 0, UINT32_MAX, settings.MeshTriangles))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--pipeline-variants") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 1, UINT32_MAX, settings.PipelineVariants))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--texture") == 0 && i + 1 < argc)
+		{
+			settings.Textures.push_back(argv[++i]);
+		}
+		else if (std::strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+		{
+			if (!ParseNumber(argv[++i], 1, UINT32_MAX, settings.TextureBudget))
+			{
+				return invalid(i);
+			}
+		}
+		else if (std::strcmp(argv[i], "--hot-reload") == 0)
+		{
+			settings.HotReload = true;
+		}
+		else if (std::strcmp(argv[i], "--pack-shaders") == 0 && i + 2 < argc)
+		{
+			// --pack-shaders <archive> <spv>..., everything after the archive is an input
+			std::string output = argv[i + 1];
+			std::vector<std::string> inputs(argv + i + 2, argv + argc);
+			return ShaderArchive::Pack(output, inputs) ? 0 : -1;
+		}
+		else if (std::strcmp(argv[i], "--device") == 0 && i + 1 < argc)
+		{
+			settings.Device = argv[++i];
+		}
+	}
+
+	if (benchmark)
+	{
+		return RunBenchmark(settings, frameCount);
+	}
+
+	if (instanceSweep)
+	{
+		return RunInstanceSweep(settings, frameCount);
+	}
+
+	if (headless)
+	{
+		return RunHeadless(settings, frameCount, statsPath, fpsLimit);
+	}
+
 	// Init SDL
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
 	{
@@ -42,7 +466,7 @@ int main(int argc, char** argv)
 	auto window_width = 800;
 	auto window_height = 600;
 
-	auto window = SDL_CreateWindow("Vulkan Test", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, window_width, window_height, SDL_WINDOW_VULKAN);
+	auto window = SDL_CreateWindow("Vulkan Test", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, window_width, window_height, SDL_WINDOW_VULKAN | SDL_WINDOW_RESIZABLE);
 	if (window == nullptr)
 	{
 		std::cerr << "SDL_CreateWindow failed\n";
@@ -50,34 +474,70 @@ int main(int argc, char** argv)
 	}
 
 	// Vulkan
-	VkRenderer renderer(window);
+	VkRenderer renderer(window, settings);
 	if (!renderer.Create())
 	{
 		return -1;
 	}
 
+	// Frame time telemetry
+	FrameStats stats;
+	FrameStatsExporter exporter(stats, statsPath, STATS_INTERVAL);
+	exporter.Start();
+	uint64_t lastSequence = 0;
+
+	// Optional CPU side cap on top of the present mode
+	FrameLimiter limiter(fpsLimit);
+
 	// Timer
 	Timer timer;
 	timer.Start();
 
 	// Main loop
 	SDL_Event e = {};
+	bool minimized = false;
 	while (e.type != SDL_QUIT)
 	{
-		timer.Tick();
-		if (SDL_PollEvent(&e))
+		// Block while minimized instead of spinning on a swapchain we can't draw to
+		if (minimized ? SDL_WaitEvent(&e) : SDL_PollEvent(&e))
 		{
+			if (e.type == SDL_WINDOWEVENT)
+			{
+				switch (e.window.event)
+				{
+				case SDL_WINDOWEVENT_SIZE_CHANGED:
+					renderer.OnResize();
+					break;
 
+				case SDL_WINDOWEVENT_MINIMIZED:
+					minimized = true;
+					timer.Stop();
+					break;
+
+				case SDL_WINDOWEVENT_RESTORED:
+					minimized = false;
+					timer.Start();
+					renderer.OnResize();
+					break;
+				}
+			}
 		}
 		else
 		{
-			CalculateFPS(&timer, window);
+			limiter.Wait();
+
+			// Tick per rendered frame so event handling counts towards the frame time
+			timer.Tick();
+			stats.Push(timer.DeltaTime());
+			UpdateTitle(&exporter, &renderer.m_GpuProfiler, window, &lastSequence);
 
+			renderer.SetTime(timer.TotalTime(), timer.DeltaTime());
 			renderer.DrawFrame();
 		}
 	}
 
 	vkDeviceWaitIdle(renderer.m_VkDevice);
+	exporter.Stop();
 
 	// Clean up
 	SDL_DestroyWindow(window);